@@ -0,0 +1,238 @@
+/*
+ * Runs a simulated TTS reply through the downlink (packet pool, jitter buffer,
+ * drift compensation) and a simulated realtime session through the uplink
+ * silence suppression, on the simulated clock of the esp_timer shim. Opus is not
+ * part of the host build, so the decoder and encoder are replaced by frames of
+ * the right size.
+ *
+ * Reports per-stage CPU time, heap allocations and the latency from a packet's
+ * arrival to its playout, so regressions show up here before they reach a device.
+ *
+ * Usage: audio_pipeline_bench [frames] [burst factor] [mean network jitter ms]
+ */
+#include "jitter_buffer.h"
+#include "drift_compensator.h"
+#include "silence_suppressor.h"
+#include "audio_packet_pool.h"
+
+#include <esp_timer.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+
+#define FRAME_MS 60
+#define UPLINK_FRAME_MS 20
+#define OUTPUT_SAMPLE_RATE 24000
+#define OPUS_PACKET_SIZE 160
+// The server stops sending ahead once it leads playout by this much
+#define SERVER_LEAD_MS 1000
+// Frames decoded ahead of the speaker, as CONFIG_AUDIO_DECODE_AHEAD_FRAMES
+#define DECODE_AHEAD_FRAMES 2
+// Frames at the start of a run that warm up the buffers and are not reported
+#define WARMUP_FRAMES 100
+
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* pointer = malloc(size == 0 ? 1 : size);
+    if (pointer == nullptr) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void operator delete(void* pointer) noexcept {
+    free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    free(pointer);
+}
+
+struct StageStats {
+    const char* name;
+    uint64_t calls = 0;
+    uint64_t cpu_ns = 0;
+    uint64_t max_cpu_ns = 0;
+    uint64_t allocations = 0;
+};
+
+// Times one call of a stage and counts its allocations, once the warm-up is over
+template <typename F>
+static void Measure(StageStats& stage, bool record, F&& function) {
+    uint64_t allocations_before = allocations.load(std::memory_order_relaxed);
+    auto start = std::chrono::steady_clock::now();
+    function();
+    uint64_t cpu_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    if (!record) {
+        return;
+    }
+    stage.calls++;
+    stage.cpu_ns += cpu_ns;
+    stage.max_cpu_ns = std::max(stage.max_cpu_ns, cpu_ns);
+    stage.allocations += allocations.load(std::memory_order_relaxed) - allocations_before;
+}
+
+static void PrintStage(const StageStats& stage) {
+    printf("  %-22s %8llu calls  %8.0f ns avg  %8llu ns max  %6llu allocations\n", stage.name,
+        (unsigned long long)stage.calls, stage.calls > 0 ? (double)stage.cpu_ns / stage.calls : 0.0,
+        (unsigned long long)stage.max_cpu_ns, (unsigned long long)stage.allocations);
+}
+
+struct Arrival {
+    int64_t time_us;
+    uint32_t sequence;
+};
+
+static void RunDownlink(int frames, int burst, int jitter_ms) {
+    std::mt19937 random(1);
+    std::exponential_distribution<double> network_delay_us(1.0 / (jitter_ms * 1000.0 + 1));
+
+    // The server sends at burst times real time until it leads playout by SERVER_LEAD_MS
+    std::vector<Arrival> arrivals;
+    int64_t send_us = 0;
+    for (int i = 0; i < frames; i++) {
+        int64_t realtime_us = (int64_t)i * FRAME_MS * 1000;
+        send_us = std::max(send_us + FRAME_MS * 1000 / burst, realtime_us - SERVER_LEAD_MS * 1000);
+        arrivals.push_back({send_us + 30000 + (int64_t)network_delay_us(random), (uint32_t)i});
+    }
+    std::stable_sort(arrivals.begin(), arrivals.end(), [](const Arrival& a, const Arrival& b) {
+        return a.time_us < b.time_us;
+    });
+
+    AudioPacketPool pool(AUDIO_PACKET_POOL_SIZE, AUDIO_PACKET_POOL_MAX_SIZE, AUDIO_PACKET_BUFFER_SIZE);
+    JitterBuffer jitter_buffer(2400 / FRAME_MS);
+    DriftCompensator drift_compensator(500);
+    StageStats receive = {"receive (pool + put)"};
+    StageStats get = {"jitter buffer get"};
+    StageStats drift = {"drift compensation"};
+
+    AudioStreamPacket incoming;
+    AudioStreamPacket decoding;
+    std::vector<int16_t> pcm;
+    size_t next_arrival = 0;
+    int64_t next_decode_us = -1;
+    int decoded = 0;
+    int concealed = 0;
+    int empty = 0;
+    uint64_t latency_sum_us = 0;
+    int64_t latency_max_us = 0;
+    int latency_count = 0;
+
+    host_timer_set_time(0);
+    while (true) {
+        int64_t now = esp_timer_get_time();
+        while (next_arrival < arrivals.size() && arrivals[next_arrival].time_us <= now) {
+            bool record = arrivals[next_arrival].sequence >= WARMUP_FRAMES;
+            Measure(receive, record, [&]() {
+                pool.Acquire(incoming.payload);
+                incoming.payload.resize(OPUS_PACKET_SIZE);
+                incoming.sequence = arrivals[next_arrival].sequence;
+                incoming.sample_rate = OUTPUT_SAMPLE_RATE;
+                incoming.frame_duration = FRAME_MS;
+                jitter_buffer.Put(std::move(incoming));
+                pool.Release(incoming.payload);
+            });
+            next_arrival++;
+        }
+
+        // The decode task keeps DECODE_AHEAD_FRAMES frames ahead of the speaker once playout starts
+        if (next_decode_us < 0 || now >= next_decode_us) {
+            bool record = decoded + concealed >= WARMUP_FRAMES;
+            JitterBufferResult result;
+            Measure(get, record, [&]() {
+                result = jitter_buffer.Get(decoding);
+            });
+            if (result == kJitterBufferEmpty) {
+                if (next_arrival == arrivals.size()) {
+                    break;
+                }
+                if (next_decode_us >= 0) {
+                    empty++;
+                }
+            } else {
+                if (next_decode_us < 0) {
+                    next_decode_us = now - DECODE_AHEAD_FRAMES * FRAME_MS * 1000;
+                }
+                next_decode_us += FRAME_MS * 1000;
+                if (result == kJitterBufferLost) {
+                    concealed++;
+                } else {
+                    decoded++;
+                    int64_t latency_us = now + DECODE_AHEAD_FRAMES * FRAME_MS * 1000 - decoding.arrival_time;
+                    if (record) {
+                        latency_sum_us += latency_us;
+                        latency_max_us = std::max(latency_max_us, latency_us);
+                        latency_count++;
+                    }
+                    Measure(drift, record, [&]() {
+                        pcm.assign(OUTPUT_SAMPLE_RATE * FRAME_MS / 1000, 0);
+                        drift_compensator.Update(decoding.sequence, decoding.arrival_time, FRAME_MS);
+                        drift_compensator.Process(pcm);
+                    });
+                    pool.Release(decoding.payload);
+                }
+                continue;
+            }
+        }
+        host_timer_advance(1000);
+    }
+
+    auto jitter = jitter_buffer.GetStats();
+    auto pool_stats = pool.GetStats();
+    printf("Downlink: %d frames of %d ms, sent at %dx real time up to %d ms ahead, %d ms mean network jitter\n",
+        frames, FRAME_MS, burst, SERVER_LEAD_MS, jitter_ms);
+    PrintStage(receive);
+    PrintStage(get);
+    PrintStage(drift);
+    printf("  arrival to speaker: %.1f ms avg, %.1f ms max\n",
+        latency_count > 0 ? latency_sum_us / 1000.0 / latency_count : 0.0, latency_max_us / 1000.0);
+    printf("  jitter buffer: target %d, jitter %d ms, late %u, lost %u (%d concealed), underruns %u, empty polls %d\n",
+        jitter.target_depth, jitter.jitter_ms, jitter.late, jitter.lost, concealed, jitter.underruns, empty);
+    printf("  packet pool: %d of %d free (min %d), %u exhausted\n", pool_stats.free, pool_stats.allocated, pool_stats.min_free,
+        pool_stats.exhausted);
+    printf("  drift compensation: %d ppm, %d samples adjusted\n", drift_compensator.ppm(), drift_compensator.adjusted_samples());
+}
+
+static void RunUplink(int frames) {
+    // Two seconds of speech, then three of silence
+    const int cycle_frames = 5000 / UPLINK_FRAME_MS;
+    const int speech_frames = 2000 / UPLINK_FRAME_MS;
+    SilenceSuppressor suppressor(500, 300);
+    StageStats suppress = {"silence suppression"};
+
+    AudioStreamPacket packet;
+    uint32_t sent = 0;
+    const std::function<void(std::vector<uint8_t>& opus)> send = [&packet, &sent](std::vector<uint8_t>& opus) {
+        packet.payload.swap(opus);
+        sent++;
+    };
+    std::vector<uint8_t> opus;
+    for (int i = 0; i < frames; i++) {
+        bool voice = i % cycle_frames < speech_frames;
+        opus.resize(voice ? 80 : 40);
+        opus[0] = 0x78;
+        Measure(suppress, i >= WARMUP_FRAMES, [&]() {
+            suppressor.Process(opus, voice, UPLINK_FRAME_MS, send);
+        });
+    }
+    printf("Uplink: %d frames of %d ms, 2 s speech and 3 s silence\n", frames, UPLINK_FRAME_MS);
+    PrintStage(suppress);
+    printf("  %u packets sent, %u frames suppressed, %d%% of the bytes saved\n", sent, suppressor.suppressed_frames(),
+        suppressor.saved_percent());
+}
+
+int main(int argc, char* argv[]) {
+    int frames = argc > 1 ? atoi(argv[1]) : 3000;
+    int burst = argc > 2 ? std::max(1, atoi(argv[2])) : 3;
+    int jitter_ms = argc > 3 ? atoi(argv[3]) : 20;
+    RunDownlink(frames, burst, jitter_ms);
+    RunUplink(frames * FRAME_MS / UPLINK_FRAME_MS);
+    return 0;
+}
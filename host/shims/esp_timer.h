@@ -0,0 +1,12 @@
+#ifndef HOST_ESP_TIMER_H
+#define HOST_ESP_TIMER_H
+
+#include <cstdint>
+
+// Microseconds on a simulated clock, which only moves when the test or benchmark advances it
+int64_t esp_timer_get_time();
+
+void host_timer_set_time(int64_t time_us);
+void host_timer_advance(int64_t delta_us);
+
+#endif // HOST_ESP_TIMER_H
@@ -0,0 +1,99 @@
+#include "audio_packet_pool.h"
+#include "jitter_buffer.h"
+#include "test_check.h"
+
+#include <esp_timer.h>
+#include <algorithm>
+
+#define FRAME_US 60000
+#define JITTER_BUFFER_CAPACITY 40
+
+// Moves packets through the pool and the jitter buffer the way the network and decode
+// tasks do: the network task acquires a buffer for each packet and releases whatever the
+// jitter buffer hands back, the decode task releases each packet it has decoded
+struct Downlink {
+    AudioPacketPool pool{AUDIO_PACKET_POOL_SIZE, AUDIO_PACKET_POOL_MAX_SIZE, AUDIO_PACKET_BUFFER_SIZE};
+    JitterBuffer jitter_buffer{JITTER_BUFFER_CAPACITY};
+    AudioStreamPacket incoming;
+    AudioStreamPacket decoding;
+    uint32_t sequence = 0;
+    int decoded = 0;
+    int max_depth = 0;
+
+    void Receive(int count) {
+        for (int i = 0; i < count; i++) {
+            pool.Acquire(incoming.payload);
+            incoming.payload.resize(160);
+            incoming.sequence = sequence++;
+            incoming.sample_rate = 24000;
+            incoming.frame_duration = 60;
+            jitter_buffer.Put(std::move(incoming));
+            pool.Release(incoming.payload);
+        }
+        max_depth = std::max(max_depth, jitter_buffer.Size());
+    }
+
+    // Plays until the jitter buffer runs dry, skipping the release like an aborted decode every skip_release packets
+    void Play(int skip_release = 0) {
+        while (true) {
+            auto result = jitter_buffer.Get(decoding);
+            if (result == kJitterBufferEmpty) {
+                return;
+            }
+            decoded++;
+            if (result == kJitterBufferPacket && (skip_release == 0 || decoded % skip_release != 0)) {
+                pool.Release(decoding.payload);
+            }
+            host_timer_advance(FRAME_US);
+        }
+    }
+};
+
+static void TestShallowStreamNeverExhausts() {
+    host_timer_set_time(0);
+    Downlink downlink;
+    for (int i = 0; i < 200; i++) {
+        downlink.Receive(AUDIO_PACKET_POOL_SIZE - 2);
+        downlink.Play();
+    }
+    auto stats = downlink.pool.GetStats();
+    CHECK(downlink.decoded == 200 * (AUDIO_PACKET_POOL_SIZE - 2));
+    CHECK(stats.exhausted == 0);
+    CHECK(stats.allocated == AUDIO_PACKET_POOL_SIZE);
+}
+
+// Alternates bursts that fill every slot with short replies, aborting every skip_release-th decode
+static void PlayReplies(Downlink& downlink, int replies, int skip_release) {
+    for (int i = 0; i < replies; i++) {
+        downlink.Receive(i % 2 == 0 ? JITTER_BUFFER_CAPACITY : 5);
+        downlink.Play(skip_release);
+    }
+}
+
+static void TestBurstsAllocateOnce() {
+    host_timer_set_time(0);
+    Downlink downlink;
+    // Bursts go deeper than the buffers allocated up front, the pool grows by the difference
+    // and keeps the new buffers, instead of leaving one behind in every jitter buffer slot
+    PlayReplies(downlink, 20, 0);
+    auto grown = downlink.pool.GetStats();
+    CHECK(grown.exhausted > 0);
+    CHECK((int)grown.exhausted <= downlink.max_depth + 2 - AUDIO_PACKET_POOL_SIZE);
+
+    // Aborted decodes leave buffers in the slots until they are reused, which takes a few more
+    PlayReplies(downlink, 20, 7);
+    auto warm = downlink.pool.GetStats();
+    CHECK(warm.allocated <= AUDIO_PACKET_POOL_MAX_SIZE);
+
+    // From then on every buffer comes back to the pool
+    PlayReplies(downlink, 200, 7);
+    auto stats = downlink.pool.GetStats();
+    CHECK(stats.exhausted == warm.exhausted);
+    CHECK(stats.allocated == warm.allocated);
+}
+
+int main() {
+    TestShallowStreamNeverExhausts();
+    TestBurstsAllocateOnce();
+    return check_failures == 0 ? 0 : 1;
+}
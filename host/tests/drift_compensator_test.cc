@@ -0,0 +1,60 @@
+#include "drift_compensator.h"
+#include "test_check.h"
+
+#include <cstdlib>
+#include <random>
+
+#define FRAME_MS 60
+
+// Feeds a stream whose server clock is off by drift_ppm, starting with a burst at three
+// times real time, and returns the playback rate the compensator settles on
+static int Settle(double drift_ppm) {
+    std::mt19937 random(1);
+    std::exponential_distribution<double> network_delay_us(1.0 / 5000);
+    DriftCompensator compensator(500);
+    for (uint32_t sequence = 0; sequence < 2000; sequence++) {
+        double send_us = sequence * FRAME_MS * 1000.0 * (1 - drift_ppm / 1000000);
+        if (sequence < 200) {
+            send_us = sequence * FRAME_MS * 1000.0 / 3;
+        }
+        compensator.Update(sequence, (int64_t)(send_us + 30000 + network_delay_us(random)), FRAME_MS);
+    }
+    return compensator.ppm();
+}
+
+static void TestSettles() {
+    CHECK(std::abs(Settle(0)) <= 20);
+    CHECK(std::abs(Settle(200) - 200) <= 20);
+    CHECK(std::abs(Settle(-300) + 300) <= 20);
+    CHECK(Settle(2000) == 0);
+}
+
+static void TestResample() {
+    DriftCompensator compensator(500);
+    // A server clock 500 ppm fast, the buffer grows so playback speeds up
+    for (uint32_t sequence = 0; sequence < 2000; sequence++) {
+        compensator.Update(sequence, (int64_t)(sequence * FRAME_MS * 1000.0 * (1 - 0.0005)), FRAME_MS);
+    }
+    CHECK(compensator.ppm() == 500);
+    std::vector<int16_t> pcm;
+    int input = 0;
+    int output = 0;
+    for (int i = 0; i < 1000; i++) {
+        pcm.assign(1440, 1000);
+        input += pcm.size();
+        compensator.Process(pcm);
+        output += pcm.size();
+        for (auto sample : pcm) {
+            CHECK(sample == 1000);
+        }
+    }
+    // 1.44 million samples played 500 ppm faster lose 720 of them, less what the Q16 step rounds off
+    CHECK(std::abs(input - output - 720) <= 36);
+    CHECK(compensator.adjusted_samples() == input - output);
+}
+
+int main() {
+    TestSettles();
+    TestResample();
+    return check_failures == 0 ? 0 : 1;
+}
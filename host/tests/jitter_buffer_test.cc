@@ -0,0 +1,136 @@
+#include "jitter_buffer.h"
+#include "test_check.h"
+
+#include <esp_timer.h>
+
+#define FRAME_US 60000
+
+static AudioStreamPacket MakePacket(uint32_t sequence) {
+    AudioStreamPacket packet;
+    packet.sequence = sequence;
+    packet.sample_rate = 24000;
+    packet.frame_duration = 60;
+    packet.payload.assign(8, (uint8_t)sequence);
+    return packet;
+}
+
+static bool Put(JitterBuffer& buffer, uint32_t sequence) {
+    auto packet = MakePacket(sequence);
+    return buffer.Put(std::move(packet));
+}
+
+// Returns the sequence of the next packet handed out, or -1
+static int64_t GetSequence(JitterBuffer& buffer, JitterBufferResult expected = kJitterBufferPacket) {
+    AudioStreamPacket packet;
+    auto result = buffer.Get(packet);
+    if (result != expected) {
+        return -1;
+    }
+    return packet.sequence;
+}
+
+static void TestInOrder() {
+    host_timer_set_time(0);
+    JitterBuffer buffer(40);
+    for (uint32_t i = 0; i < 5; i++) {
+        CHECK(Put(buffer, i));
+        host_timer_advance(FRAME_US);
+    }
+    for (uint32_t i = 0; i < 5; i++) {
+        CHECK(GetSequence(buffer) == i);
+    }
+    AudioStreamPacket packet;
+    CHECK(buffer.Get(packet) == kJitterBufferEmpty);
+}
+
+static void TestReordered() {
+    host_timer_set_time(0);
+    JitterBuffer buffer(40);
+    CHECK(Put(buffer, 0));
+    CHECK(Put(buffer, 2));
+    CHECK(Put(buffer, 1));
+    CHECK(GetSequence(buffer) == 0);
+    CHECK(GetSequence(buffer) == 1);
+    CHECK(GetSequence(buffer) == 2);
+    CHECK(buffer.GetStats().reordered == 1);
+    CHECK(!Put(buffer, 1));
+    CHECK(buffer.GetStats().late == 1);
+}
+
+static void TestLost() {
+    host_timer_set_time(0);
+    JitterBuffer buffer(40);
+    CHECK(Put(buffer, 0));
+    CHECK(Put(buffer, 2));
+    CHECK(GetSequence(buffer) == 0);
+    // The concealed frame comes with the packet after it, for its FEC data
+    AudioStreamPacket packet;
+    CHECK(buffer.Get(packet) == kJitterBufferLost);
+    CHECK(packet.sequence == 1);
+    CHECK(packet.payload.size() == 8 && packet.payload[0] == 2);
+    CHECK(GetSequence(buffer) == 2);
+    CHECK(buffer.GetStats().lost == 1);
+}
+
+static void TestSequenceWrap() {
+    host_timer_set_time(0);
+    JitterBuffer buffer(40);
+    uint32_t first = UINT32_MAX - 2;
+    for (uint32_t i = 0; i < 6; i++) {
+        CHECK(Put(buffer, first + i));
+        host_timer_advance(FRAME_US);
+    }
+    for (uint32_t i = 0; i < 6; i++) {
+        CHECK(GetSequence(buffer) == (uint32_t)(first + i));
+    }
+    CHECK(buffer.GetStats().lost == 0);
+}
+
+static void TestUnderruns() {
+    host_timer_set_time(0);
+    JitterBuffer buffer(40);
+    CHECK(Put(buffer, 0));
+    CHECK(GetSequence(buffer) == 0);
+    AudioStreamPacket packet;
+    CHECK(buffer.Get(packet) == kJitterBufferEmpty);
+    CHECK(Put(buffer, 1));
+    CHECK(buffer.GetStats().underruns == 1);
+
+    // Running dry after the end of a stream is not an underrun
+    CHECK(GetSequence(buffer) == 1);
+    buffer.MarkEndOfStream();
+    CHECK(buffer.Get(packet) == kJitterBufferEmpty);
+    host_timer_advance(2000000);
+    CHECK(Put(buffer, 2));
+    CHECK(buffer.GetStats().underruns == 1);
+}
+
+static void TestBurstIsNotJitter() {
+    host_timer_set_time(0);
+    JitterBuffer buffer(40);
+    // A reply sent three times faster than real time, then at real time
+    uint32_t sequence = 0;
+    for (; sequence < 30; sequence++) {
+        CHECK(Put(buffer, sequence));
+        host_timer_advance(FRAME_US / 3);
+        if (sequence % 3 == 2) {
+            GetSequence(buffer);
+        }
+    }
+    for (; sequence < 60; sequence++) {
+        CHECK(Put(buffer, sequence));
+        host_timer_advance(FRAME_US);
+        GetSequence(buffer);
+    }
+    CHECK(buffer.GetStats().target_depth == JITTER_BUFFER_MIN_DEPTH);
+}
+
+int main() {
+    TestInOrder();
+    TestReordered();
+    TestLost();
+    TestSequenceWrap();
+    TestUnderruns();
+    TestBurstIsNotJitter();
+    return check_failures == 0 ? 0 : 1;
+}
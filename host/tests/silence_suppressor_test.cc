@@ -0,0 +1,96 @@
+#include "silence_suppressor.h"
+#include "test_check.h"
+
+#define FRAME_MS 20
+#define HANGOVER_MS 60
+
+// Runs frames through the suppressor. Real frames carry their index in the second byte,
+// markers are a single TOC byte and are reported as -1
+static std::vector<int> Run(int lookback_ms, const std::vector<bool>& voice) {
+    SilenceSuppressor suppressor(HANGOVER_MS, lookback_ms);
+    std::vector<int> sent;
+    const std::function<void(std::vector<uint8_t>& opus)> send = [&sent](std::vector<uint8_t>& opus) {
+        sent.push_back(opus.size() == 1 ? -1 : opus[1]);
+    };
+    for (size_t i = 0; i < voice.size(); i++) {
+        std::vector<uint8_t> frame = {0x78, (uint8_t)i, 1, 2};
+        suppressor.Process(frame, voice[i], FRAME_MS, send);
+    }
+    return sent;
+}
+
+static std::vector<bool> SpeechPauseSpeech() {
+    std::vector<bool> voice(20, false);
+    for (int i = 0; i < 3; i++) {
+        voice[i] = true;
+    }
+    for (int i = 15; i < 20; i++) {
+        voice[i] = true;
+    }
+    return voice;
+}
+
+static void TestEveryFrameOnce(int lookback_ms) {
+    auto sent = Run(lookback_ms, SpeechPauseSpeech());
+    CHECK(sent.size() == 20);
+    // Real frames keep their order, markers stand in for the others
+    int last = -1;
+    for (auto index : sent) {
+        if (index < 0) {
+            continue;
+        }
+        CHECK(index > last);
+        last = index;
+    }
+    CHECK(last == 19);
+}
+
+static void TestLookbackSendsSpeechStart() {
+    auto sent = Run(120, SpeechPauseSpeech());
+    // The silence up to frame 8 is replaced, the 120 ms before the speech is sent as audio
+    std::vector<int> expected = {0, 1, 2, 3, 4, 5, -1, -1, -1, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19};
+    CHECK(sent == expected);
+}
+
+static void TestSavedBytes() {
+    SilenceSuppressor suppressor(HANGOVER_MS, 0);
+    const std::function<void(std::vector<uint8_t>& opus)> send = [](std::vector<uint8_t>&) {};
+    for (int i = 0; i < 100; i++) {
+        std::vector<uint8_t> frame(40, 0x78);
+        suppressor.Process(frame, false, FRAME_MS, send);
+    }
+    CHECK(suppressor.suppressed_frames() == 100 - (HANGOVER_MS / FRAME_MS));
+    CHECK(suppressor.saved_percent() > 90);
+}
+
+static void TestResetSendsHeldMarkers() {
+    SilenceSuppressor suppressor(HANGOVER_MS, 120);
+    std::vector<int> sent;
+    const std::function<void(std::vector<uint8_t>& opus)> send = [&sent](std::vector<uint8_t>& opus) {
+        sent.push_back(opus.size() == 1 ? -1 : opus[1]);
+    };
+    for (int i = 0; i < 10; i++) {
+        std::vector<uint8_t> frame = {0x78, (uint8_t)i, 1, 2};
+        suppressor.Process(frame, false, FRAME_MS, send);
+    }
+    // Three frames sent in the hangover, one marker, six held for the lookback
+    CHECK(sent.size() == 4);
+    suppressor.Reset(send);
+    CHECK(sent.size() == 10);
+    std::vector<int> expected = {0, 1, 2, -1, -1, -1, -1, -1, -1, -1};
+    CHECK(sent == expected);
+    // The new stream starts with audio again
+    std::vector<uint8_t> frame = {0x78, 10, 1, 2};
+    suppressor.Process(frame, false, FRAME_MS, send);
+    CHECK(sent.back() == 10);
+}
+
+int main() {
+    TestEveryFrameOnce(0);
+    TestEveryFrameOnce(10);
+    TestEveryFrameOnce(120);
+    TestLookbackSendsSpeechStart();
+    TestSavedBytes();
+    TestResetSendsHeldMarkers();
+    return check_failures == 0 ? 0 : 1;
+}
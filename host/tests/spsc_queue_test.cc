@@ -0,0 +1,81 @@
+#include "spsc_queue.h"
+#include "test_check.h"
+
+#include <thread>
+
+static void TestCapacity() {
+    SpscQueue<int> queue(40);
+    CHECK(queue.capacity() == 64);
+    for (int i = 0; i < 64; i++) {
+        CHECK(queue.Push(i));
+    }
+    CHECK(!queue.Push(64));
+    CHECK(queue.overflows() == 1);
+    int item = -1;
+    CHECK(queue.Pop(item) && item == 0);
+}
+
+static void TestBuffersCirculate() {
+    // One slot, so every item goes through the same one
+    SpscQueue<std::vector<uint8_t>> queue(1);
+    std::vector<uint8_t> produced(100);
+    auto produced_data = produced.data();
+    CHECK(queue.Push(std::move(produced)));
+    CHECK(produced.empty());
+
+    std::vector<uint8_t> consumed(50);
+    auto consumed_data = consumed.data();
+    CHECK(queue.Pop(consumed));
+    CHECK(consumed.data() == produced_data);
+
+    // The buffer the consumer was done with comes back to the producer
+    std::vector<uint8_t> next(10);
+    CHECK(queue.Push(std::move(next)));
+    CHECK(next.data() == consumed_data);
+}
+
+static void TestTrimAndClear() {
+    SpscQueue<int> queue(8);
+    for (int i = 0; i < 6; i++) {
+        queue.Push(i);
+    }
+    CHECK(queue.Trim(2) == 4);
+    int item = -1;
+    CHECK(queue.Pop(item) && item == 4);
+    queue.Clear();
+    CHECK(queue.Empty());
+    CHECK(!queue.Pop(item));
+    queue.Push(7);
+    CHECK(queue.Pop(item) && item == 7);
+}
+
+static void TestThreads() {
+    SpscQueue<uint32_t> queue(16);
+    const uint32_t count = 20000;
+    std::thread producer([&queue]() {
+        for (uint32_t i = 0; i < count; i++) {
+            while (!queue.Push(i)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    uint32_t expected = 0;
+    while (expected < count) {
+        uint32_t item;
+        if (queue.Pop(item)) {
+            CHECK(item == expected);
+            expected++;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+}
+
+int main() {
+    TestCapacity();
+    TestBuffersCirculate();
+    TestTrimAndClear();
+    TestThreads();
+    return check_failures == 0 ? 0 : 1;
+}
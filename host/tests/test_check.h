@@ -0,0 +1,16 @@
+#ifndef HOST_TEST_CHECK_H
+#define HOST_TEST_CHECK_H
+
+#include <cstdio>
+
+// Counts the failed checks of a test program, main() returns non-zero if there are any
+static int check_failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+        check_failures++; \
+    } \
+} while (0)
+
+#endif // HOST_TEST_CHECK_H
@@ -10,6 +10,7 @@
 #include "iot/thing_manager.h"
 #include "assets/lang_config.h"
 #include "mcp_server.h"
+#include "latency_tracer.h"
 #include "audio_debugger.h"
 
 #if CONFIG_USE_AUDIO_PROCESSOR
@@ -27,6 +28,7 @@
 #endif
 
 #include <cstring>
+#include <algorithm>
 #include <esp_log.h>
 #include <cJSON.h>
 #include <driver/gpio.h>
@@ -58,7 +60,6 @@ Application::Application() {
         printf("SD卡初始化失败！\n");
     }
     event_group_ = xEventGroupCreate();
-    background_task_ = new BackgroundTask(4096 * 7);
 
 #if CONFIG_USE_DEVICE_AEC
     aec_mode_ = kAecOnDeviceSide;
@@ -100,9 +101,6 @@ Application::~Application() {
         esp_timer_stop(clock_timer_handle_);
         esp_timer_delete(clock_timer_handle_);
     }
-    if (background_task_ != nullptr) {
-        delete background_task_;
-    }
     vEventGroupDelete(event_group_);
 }
 
@@ -158,13 +156,9 @@ void Application::CheckNewVersion(Ota& ota) {
             auto codec = board.GetAudioCodec();
             codec->EnableInput(false);
             codec->EnableOutput(false);
-            {
-                std::lock_guard<std::mutex> lock(mutex_);
-                audio_decode_queue_.clear();
-            }
-            background_task_->WaitForCompletion();
-            delete background_task_;
-            background_task_ = nullptr;
+            audio_decode_queue_.Clear();
+            jitter_buffer_.Reset();
+            audio_pcm_queue_.Clear();
             vTaskDelay(pdMS_TO_TICKS(1000));
 
             ota.StartUpgrade([display](int progress, size_t speed) {
@@ -232,7 +226,6 @@ void Application::ShowActivationCode(const std::string& code, const std::string&
         digit_sound{'9', Lang::Sounds::P3_9}
     }};
 
-    // This sentence uses 9KB of SRAM, so we need to wait for it to finish
     Alert(Lang::Strings::ACTIVATION, message.c_str(), "happy", Lang::Sounds::P3_ACTIVATION);
 
     for (const auto& digit : code) {
@@ -265,48 +258,90 @@ void Application::DismissAlert() {
     }
 }
 
-void Application::PlaySound(const std::string_view& sound) {
-    // Wait for the previous sound to finish
-    {
-        std::unique_lock<std::mutex> lock(mutex_);
-        audio_decode_cv_.wait(lock, [this]() {
-            return audio_decode_queue_.empty();
-        });
+// Queues the sound and returns right away, it plays after the sounds queued before it.
+// The sound data must stay valid until it has played, which the embedded assets always do.
+bool Application::PlaySound(const std::string_view& sound) {
+    QueuedSound queued;
+    queued.data = sound;
+    queued.generation = sound_generation_;
+#if CONFIG_USE_SOUND_PCM_CACHE
+    // Cached cues keep their place in the queue but skip the decoder
+    if (sound_cache_ready_) {
+        queued.cached = sound_cache_.Find(sound);
+        if (queued.cached != nullptr) {
+            cue_request_time_ = esp_timer_get_time();
+        }
     }
-    background_task_->WaitForCompletion();
-
-    const char* data = sound.data();
-    size_t size = sound.size();
-    for (const char* p = data; p < data + size; ) {
-        auto p3 = (BinaryProtocol3*)p;
-        p += sizeof(BinaryProtocol3);
-
-        auto payload_size = ntohs(p3->payload_size);
-        AudioStreamPacket packet;
-        packet.sample_rate = 16000;
-        packet.frame_duration = 60;
-        packet.payload.resize(payload_size);
-        memcpy(packet.payload.data(), p3->payload, payload_size);
-        p += payload_size;
+#endif
+    if (!sound_queue_.Push(std::move(queued))) {
+        ESP_LOGW(TAG, "Sound queue is full, drop the sound");
+        return false;
+    }
+    if (audio_decode_task_handle_ != nullptr) {
+        xTaskNotifyGive(audio_decode_task_handle_);
+    }
+    return true;
+}
 
-        std::lock_guard<std::mutex> lock(mutex_);
-        audio_decode_queue_.emplace_back(std::move(packet));
+// Decode task only. Returns the next Opus frame of the queued sounds, pointing into the sound data,
+// or the cached PCM in cue if the next sound is a cached one.
+bool Application::NextSoundFrame(const uint8_t*& payload, size_t& size, const CachedSound*& cue) {
+    while (true) {
+        auto& sound = playing_sound_.data;
+        if (playing_sound_.generation == sound_generation_ &&
+            playing_sound_offset_ + sizeof(BinaryProtocol3) <= sound.size()) {
+            auto p3 = (const BinaryProtocol3*)(sound.data() + playing_sound_offset_);
+            size_t payload_size = ntohs(p3->payload_size);
+            playing_sound_offset_ += sizeof(BinaryProtocol3) + payload_size;
+            if (playing_sound_offset_ <= sound.size()) {
+                payload = p3->payload;
+                size = payload_size;
+                return true;
+            }
+            ESP_LOGW(TAG, "Sound data is truncated");
+        }
+        // Sounds queued before the last ResetDecoder() are skipped
+        if (!sound_queue_.Pop(playing_sound_)) {
+            playing_sound_ = QueuedSound();
+            return false;
+        }
+        playing_sound_offset_ = 0;
+        if (playing_sound_.cached != nullptr) {
+            bool current = playing_sound_.generation == sound_generation_;
+            cue = playing_sound_.cached;
+            playing_sound_ = QueuedSound();
+            if (current) {
+                return true;
+            }
+            cue = nullptr;
+        }
     }
 }
 
 void Application::EnterAudioTestingMode() {
     ESP_LOGI(TAG, "Entering audio testing mode");
     ResetDecoder();
+    audio_encoder_reset_ = true;
     SetDeviceState(kDeviceStateAudioTesting);
 }
 
 void Application::ExitAudioTestingMode() {
     ESP_LOGI(TAG, "Exiting audio testing mode");
     SetDeviceState(kDeviceStateWifiConfiguring);
-    // Copy audio_testing_queue_ to audio_decode_queue_
+    // The recording is longer than the decode queue, the decode task feeds it in as the queue drains
+    audio_testing_playback_ = true;
+}
+
+// Decode task only, it is both the producer and the consumer of audio_decode_queue_
+void Application::FeedAudioTestingPlayback() {
     std::lock_guard<std::mutex> lock(mutex_);
-    audio_decode_queue_ = std::move(audio_testing_queue_);
-    audio_decode_cv_.notify_all();
+    while (!audio_testing_queue_.empty() && audio_decode_queue_.Size() < MAX_AUDIO_PACKETS_IN_QUEUE) {
+        audio_decode_queue_.Push(std::move(audio_testing_queue_.front()));
+        audio_testing_queue_.pop_front();
+    }
+    if (audio_testing_queue_.empty()) {
+        audio_testing_playback_ = false;
+    }
 }
 
 void Application::ToggleChatState() {
@@ -327,15 +362,18 @@ void Application::ToggleChatState() {
     }
 
     if (device_state_ == kDeviceStateIdle) {
+        LatencyTracer::GetInstance().BeginTurn();
+        // Only what is said after the press is sent
+        preroll_.Clear();
         Schedule([this]() {
             if (!protocol_->IsAudioChannelOpened()) {
                 SetDeviceState(kDeviceStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
+                if (!OpenAudioChannel(GetDefaultListeningMode())) {
                     return;
                 }
             }
 
-            SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+            SetListeningMode(GetDefaultListeningMode());
         });
     } else if (device_state_ == kDeviceStateSpeaking) {
         Schedule([this]() {
@@ -363,10 +401,13 @@ void Application::StartListening() {
     }
     
     if (device_state_ == kDeviceStateIdle) {
+        LatencyTracer::GetInstance().BeginTurn();
+        // Only what is said after the press is sent
+        preroll_.Clear();
         Schedule([this]() {
             if (!protocol_->IsAudioChannelOpened()) {
                 SetDeviceState(kDeviceStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
+                if (!OpenAudioChannel(kListeningModeManualStop)) {
                     return;
                 }
             }
@@ -414,21 +455,24 @@ void Application::Start() {
 
     /* Setup the audio codec */
     auto codec = board.GetAudioCodec();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_->SetComplexity(0);
+    opus_decoder_ = std::make_unique<OpusFecDecoder>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
+    // Starting complexity, the encode task adjusts it to the CPU load from there
+    int complexity = 0;
     if (aec_mode_ != kAecOff) {
-        ESP_LOGI(TAG, "AEC mode: %d, setting opus encoder complexity to 0", aec_mode_);
-        opus_encoder_->SetComplexity(0);
+        ESP_LOGI(TAG, "AEC mode: %d, starting opus encoder complexity at 0", aec_mode_);
     } else {
 #if CONFIG_USE_AUDIO_PROCESSOR
-        ESP_LOGI(TAG, "Audio processor detected, setting opus encoder complexity to 5");
-        opus_encoder_->SetComplexity(5);
+        ESP_LOGI(TAG, "Audio processor detected, starting opus encoder complexity at 5");
+        complexity = 5;
 #else
-        ESP_LOGI(TAG, "Audio processor not detected, setting opus encoder complexity to 0");
-        opus_encoder_->SetComplexity(0);
+        ESP_LOGI(TAG, "Audio processor not detected, starting opus encoder complexity at 0");
 #endif
     }
+    encoder_controller_.Reset(complexity, CONFIG_AUDIO_ENCODE_BITRATE_MAX);
+    CreateEncoder(GetUplinkFrameDuration());
+
+    // Samples handed to the codec wait in its DMA buffers before they are played
+    playback_clock_.Configure((uint64_t)AUDIO_CODEC_DMA_DESC_NUM * AUDIO_CODEC_DMA_FRAME_NUM * 1000000 / codec->output_sample_rate());
 
     if (codec->input_sample_rate() != 16000) {
         input_resampler_.Configure(codec->input_sample_rate(), 16000);
@@ -450,6 +494,29 @@ void Application::Start() {
     }, "audio_loop", 4096 * 2, this, 8, &audio_loop_task_handle_);
 #endif
 
+    // Encoding and decoding can run in parallel on dual-core chips, see the audio task options in Kconfig.
+    // Together they replace the 28 KB background task that used to run both codecs. The Opus encoder
+    // needs most of that, decoding with FEC and resampling needs far less
+    xTaskCreatePinnedToCore([](void* arg) {
+        Application* app = (Application*)arg;
+        app->AudioEncodeLoop();
+        vTaskDelete(NULL);
+    }, "audio_encode", 4096 * 6, this, CONFIG_AUDIO_ENCODE_TASK_PRIORITY, &audio_encode_task_handle_,
+        CONFIG_AUDIO_ENCODE_TASK_CORE < 0 ? tskNO_AFFINITY : CONFIG_AUDIO_ENCODE_TASK_CORE);
+
+    xTaskCreatePinnedToCore([](void* arg) {
+        Application* app = (Application*)arg;
+        app->AudioDecodeLoop();
+        vTaskDelete(NULL);
+    }, "audio_decode", 4096 * 3, this, CONFIG_AUDIO_DECODE_TASK_PRIORITY, &audio_decode_task_handle_,
+        CONFIG_AUDIO_DECODE_TASK_CORE < 0 ? tskNO_AFFINITY : CONFIG_AUDIO_DECODE_TASK_CORE);
+
+    xTaskCreate([](void* arg) {
+        Application* app = (Application*)arg;
+        app->AudioOutputLoop();
+        vTaskDelete(NULL);
+    }, "audio_output", 4096, this, 8, &audio_output_task_handle_);
+
     /* Start the clock timer to update the status bar */
     esp_timer_start_periodic(clock_timer_handle_, 1000000);
 
@@ -479,15 +546,32 @@ void Application::Start() {
         ESP_LOGW(TAG, "No protocol specified in the OTA config, using MQTT");
         protocol_ = std::make_unique<MqttProtocol>();
     }
+    if (jitter_buffer_.capacity() + 2 > AUDIO_PACKET_POOL_MAX_SIZE) {
+        ESP_LOGW(TAG, "Audio packet pool keeps %d buffers, fewer than the %d jitter buffer slots need",
+            AUDIO_PACKET_POOL_MAX_SIZE, jitter_buffer_.capacity() + 2);
+    }
 
     protocol_->OnNetworkError([this](const std::string& message) {
+#if CONFIG_USE_SPECULATIVE_CHANNEL_OPEN
+        // Nobody is waiting for a channel opened speculatively, so fail silently
+        if (speculative_channel_) {
+            ESP_LOGW(TAG, "Speculative audio channel failed: %s", message.c_str());
+            Schedule([this]() {
+                ClaimSpeculativeChannel(true);
+            });
+            return;
+        }
+#endif
         SetDeviceState(kDeviceStateIdle);
         Alert(Lang::Strings::ERROR, message.c_str(), "sad", Lang::Sounds::P3_EXCLAMATION);
     });
     protocol_->OnIncomingAudio([this](AudioStreamPacket&& packet) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (device_state_ == kDeviceStateSpeaking && audio_decode_queue_.size() < MAX_AUDIO_PACKETS_IN_QUEUE) {
-            audio_decode_queue_.emplace_back(std::move(packet));
+        LatencyTracer::GetInstance().Mark(kLatencyFirstIncomingAudio);
+        if (device_state_ == kDeviceStateSpeaking) {
+            jitter_buffer_.Put(std::move(packet));
+            if (audio_decode_task_handle_ != nullptr) {
+                xTaskNotifyGive(audio_decode_task_handle_);
+            }
         }
     });
     protocol_->OnAudioChannelOpened([this, codec, &board]() {
@@ -509,6 +593,9 @@ void Application::Start() {
     protocol_->OnAudioChannelClosed([this, &board]() {
         board.SetPowerSaveMode(true);
         Schedule([this]() {
+#if CONFIG_USE_SPECULATIVE_CHANNEL_OPEN
+            ClaimSpeculativeChannel(true);
+#endif
             auto display = Board::GetInstance().GetDisplay();
             display->SetChatMessage("system", "");
             SetDeviceState(kDeviceStateIdle);
@@ -520,21 +607,23 @@ void Application::Start() {
         if (strcmp(type->valuestring, "tts") == 0) {
             auto state = cJSON_GetObjectItem(root, "state");
             if (strcmp(state->valuestring, "start") == 0) {
+                LatencyTracer::GetInstance().Mark(kLatencyTtsStart);
                 Schedule([this]() {
                     aborted_ = false;
+                    // A new reply cancels leaving speaking for the last one
+                    playback_drain_state_ = kPlaybackDrainIdle;
                     if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
                         SetDeviceState(kDeviceStateSpeaking);
                     }
                 });
             } else if (strcmp(state->valuestring, "stop") == 0) {
+                jitter_buffer_.MarkEndOfStream();
                 Schedule([this]() {
-                    background_task_->WaitForCompletion();
-                    if (device_state_ == kDeviceStateSpeaking) {
-                        if (listening_mode_ == kListeningModeManualStop) {
-                            SetDeviceState(kDeviceStateIdle);
-                        } else {
-                            SetDeviceState(kDeviceStateListening);
-                        }
+                    // The output task reports when the buffered audio has played out, see CheckPlaybackDrained()
+                    playback_drain_start_ = esp_timer_get_time();
+                    playback_drain_state_ = kPlaybackDrainWaiting;
+                    if (audio_output_task_handle_ != nullptr) {
+                        xTaskNotifyGive(audio_output_task_handle_);
                     }
                 });
             } else if (strcmp(state->valuestring, "sentence_start") == 0) {
@@ -610,44 +699,20 @@ void Application::Start() {
     audio_debugger_ = std::make_unique<AudioDebugger>();
     audio_processor_->Initialize(codec);
     audio_processor_->OnOutput([this](std::vector<int16_t>&& data) {
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            if (audio_send_queue_.size() >= MAX_AUDIO_PACKETS_IN_QUEUE) {
-                ESP_LOGW(TAG, "Too many audio packets in queue, drop the newest packet");
-                return;
-            }
-        }
-        background_task_->Schedule([this, data = std::move(data)]() mutable {
-            opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
-                AudioStreamPacket packet;
-                packet.payload = std::move(opus);
-#ifdef CONFIG_USE_SERVER_AEC
-                {
-                    std::lock_guard<std::mutex> lock(timestamp_mutex_);
-                    if (!timestamp_queue_.empty()) {
-                        packet.timestamp = timestamp_queue_.front();
-                        timestamp_queue_.pop_front();
-                    } else {
-                        packet.timestamp = 0;
-                    }
-
-                    if (timestamp_queue_.size() > 3) { // 限制队列长度3
-                        timestamp_queue_.pop_front(); // 该包发送前先出队保持队列长度
-                        return;
-                    }
-                }
+#if CONFIG_USE_LOCAL_BARGE_IN
+        CheckBargeIn();
 #endif
-                std::lock_guard<std::mutex> lock(mutex_);
-                if (audio_send_queue_.size() >= MAX_AUDIO_PACKETS_IN_QUEUE) {
-                    ESP_LOGW(TAG, "Too many audio packets in queue, drop the oldest packet");
-                    audio_send_queue_.pop_front();
-                }
-                audio_send_queue_.emplace_back(std::move(packet));
-                xEventGroupSetBits(event_group_, SEND_AUDIO_EVENT);
-            });
-        });
+        if (audio_send_queue_.Size() >= MAX_AUDIO_QUEUE_DURATION_MS / GetUplinkFrameDuration()) {
+            ESP_LOGW(TAG, "Too many audio packets in queue, drop the newest packet");
+            audio_send_dropped_newest_++;
+            return;
+        }
+        PushEncodeQueue(std::move(data), false);
     });
     audio_processor_->OnVadStateChange([this](bool speaking) {
+#if CONFIG_USE_AUDIO_DTX
+        uplink_voice_ = speaking;
+#endif
         if (device_state_ == kDeviceStateListening) {
             Schedule([this, speaking]() {
                 if (speaking) {
@@ -659,10 +724,24 @@ void Application::Start() {
                 led->OnStateChanged();
             });
         }
+#if CONFIG_USE_LOCAL_BARGE_IN
+        // With the echo cancelled on the device, voice while speaking is the user talking over the reply.
+        // It only counts once it lasts, see CheckBargeIn()
+        else if (device_state_ == kDeviceStateSpeaking && aec_mode_ == kAecOnDeviceSide) {
+            barge_in_voice_start_ = speaking ? esp_timer_get_time() : 0;
+        }
+#endif
     });
 
     wake_word_->Initialize(codec);
     wake_word_->OnWakeWordDetected([this](const std::string& wake_word) {
+        auto& tracer = LatencyTracer::GetInstance();
+        tracer.BeginTurn();
+        tracer.Mark(kLatencyWakeWord);
+#if CONFIG_USE_AFE_WAKE_WORD
+        // The audio up to the wake word is sent by the wake word itself
+        preroll_.Clear();
+#endif
         Schedule([this, &wake_word]() {
             if (!protocol_) {
                 return;
@@ -673,7 +752,7 @@ void Application::Start() {
 
                 if (!protocol_->IsAudioChannelOpened()) {
                     SetDeviceState(kDeviceStateConnecting);
-                    if (!protocol_->OpenAudioChannel()) {
+                    if (!OpenAudioChannel(GetDefaultListeningMode())) {
                         wake_word_->StartDetection();
                         return;
                     }
@@ -689,13 +768,11 @@ void Application::Start() {
                 // Set the chat state to wake word detected
                 protocol_->SendWakeWordDetected(wake_word);
 #else
-                // Play the pop up sound to indicate the wake word is detected
-                // And wait 60ms to make sure the queue has been processed by audio task
+                // Play the pop up sound to indicate the wake word is detected, it starts within a frame
                 ResetDecoder();
                 PlaySound(Lang::Sounds::P3_POPUP);
-                vTaskDelay(pdMS_TO_TICKS(60));
 #endif
-                SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+                SetListeningMode(GetDefaultListeningMode());
             } else if (device_state_ == kDeviceStateSpeaking) {
                 AbortSpeaking(kAbortReasonWakeWordDetected);
             } else if (device_state_ == kDeviceStateActivating) {
@@ -703,6 +780,15 @@ void Application::Start() {
             }
         });
     });
+#if CONFIG_USE_SPECULATIVE_CHANNEL_OPEN
+    wake_word_->OnVadStateChange([this](bool speaking) {
+        if (speaking && device_state_ == kDeviceStateIdle && !speculative_channel_) {
+            Schedule([this]() {
+                OpenSpeculativeChannel();
+            });
+        }
+    });
+#endif
     wake_word_->StartDetection();
 
     // Wait for the new version check to finish
@@ -732,12 +818,61 @@ void Application::OnClockTimer() {
     auto display = Board::GetInstance().GetDisplay();
     display->UpdateStatusBar();
 
+#if CONFIG_USE_SPECULATIVE_CHANNEL_OPEN
+    if (speculative_channel_ && device_state_ == kDeviceStateIdle &&
+        esp_timer_get_time() - speculative_open_time_ > CONFIG_SPECULATIVE_CHANNEL_IDLE_TIMEOUT_MS * 1000LL) {
+        Schedule([this]() {
+            CloseSpeculativeChannel();
+        });
+    }
+#endif
+
     // Print the debug info every 10 seconds
     if (clock_ticks_ % 10 == 0) {
         // SystemInfo::PrintTaskCpuUsage(pdMS_TO_TICKS(1000));
         // SystemInfo::PrintTaskList();
         SystemInfo::PrintHeapStats();
 
+        auto stats = GetAudioQueueStats();
+        if (stats.decode_dropped || stats.send_dropped_newest || stats.send_dropped_oldest) {
+            ESP_LOGW(TAG, "Audio queue drops: decode %lu, send newest %lu, send oldest %lu",
+                stats.decode_dropped, stats.send_dropped_newest, stats.send_dropped_oldest);
+        }
+        LogScheduleStats();
+        if (audio_encode_task_handle_ != nullptr && audio_decode_task_handle_ != nullptr && audio_output_task_handle_ != nullptr) {
+            ESP_LOGI(TAG, "Audio task stack free: encode %u, decode %u, output %u bytes",
+                uxTaskGetStackHighWaterMark(audio_encode_task_handle_), uxTaskGetStackHighWaterMark(audio_decode_task_handle_),
+                uxTaskGetStackHighWaterMark(audio_output_task_handle_));
+        }
+        // The input buffers only grow while the first frames are read, or when the feed size changes
+        if (input_buffer_grows_ != input_buffer_grows_reported_) {
+            input_buffer_grows_reported_ = input_buffer_grows_;
+            ESP_LOGI(TAG, "Audio input buffers grown %lu times", input_buffer_grows_reported_);
+        }
+        if (protocol_ && protocol_->audio_bytes_sent() != audio_bytes_sent_reported_) {
+            audio_bytes_sent_reported_ = protocol_->audio_bytes_sent();
+            ESP_LOGI(TAG, "Uplink audio: %lu bytes sent, %lu bytes copied into message buffers",
+                audio_bytes_sent_reported_, protocol_->audio_bytes_copied());
+        }
+        if (protocol_) {
+            auto pool = protocol_->GetAudioPacketPoolStats();
+            if (pool.exhausted != audio_pool_exhausted_reported_ || pool.oversized != audio_pool_oversized_reported_) {
+                audio_pool_exhausted_reported_ = pool.exhausted;
+                audio_pool_oversized_reported_ = pool.oversized;
+                ESP_LOGW(TAG, "Audio packet pool: %d of %d buffers free (min %d), exhausted %lu times, %lu oversized packets",
+                    pool.free, pool.allocated, pool.min_free, pool.exhausted, pool.oversized);
+            }
+        }
+#if CONFIG_USE_AUDIO_DTX
+        uint32_t encoded_bytes = silence_suppressor_.encoded_bytes();
+        if (encoded_bytes != dtx_encoded_bytes_reported_) {
+            dtx_encoded_bytes_reported_ = encoded_bytes;
+            ESP_LOGI(TAG, "Uplink silence suppression: sent %lu of %lu bytes (%d%% saved), %lu frames suppressed, markers %d ms late",
+                silence_suppressor_.sent_bytes(), encoded_bytes, silence_suppressor_.saved_percent(),
+                silence_suppressor_.suppressed_frames(), CONFIG_AUDIO_DTX_LOOKBACK_MS);
+        }
+#endif
+
         // If we have synchronized server time, set the status to clock "HH:MM" if the device is idle
         if (has_server_time_) {
             if (device_state_ == kDeviceStateIdle) {
@@ -753,15 +888,71 @@ void Application::OnClockTimer() {
     }
 }
 
-// Add a async task to MainLoop
-void Application::Schedule(std::function<void()> callback) {
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        main_tasks_.push_back(std::move(callback));
+void Application::PushMainTask(ScheduledTask&& task) {
+    // Producers never block. Once a task has spilled over, the following ones join it
+    // so that tasks still run in the order they were scheduled
+    if (schedule_overflow_pending_ || !main_tasks_.Push(std::move(task))) {
+        std::lock_guard<std::mutex> lock(schedule_overflow_mutex_);
+        schedule_overflow_.push_back(std::move(task));
+        schedule_overflow_pending_ = true;
+        schedule_overflows_++;
     }
     xEventGroupSetBits(event_group_, SCHEDULE_EVENT);
 }
 
+void Application::RunMainTasks() {
+    ScheduledTask task;
+    while (main_tasks_.Pop(task)) {
+        RunMainTask(task);
+    }
+    if (schedule_overflow_pending_) {
+        std::list<ScheduledTask> overflow;
+        {
+            std::lock_guard<std::mutex> lock(schedule_overflow_mutex_);
+            overflow.swap(schedule_overflow_);
+            schedule_overflow_pending_ = false;
+        }
+        for (auto& overflow_task : overflow) {
+            RunMainTask(overflow_task);
+        }
+    }
+}
+
+void Application::RunMainTask(ScheduledTask& task) {
+    int64_t start_time = esp_timer_get_time();
+    uint32_t wait_us = start_time - task.schedule_time;
+    if (wait_us > SCHEDULE_SLOW_WAIT_US) {
+        ESP_LOGW(TAG, "Scheduled task waited %lu ms", wait_us / 1000);
+    }
+    task.callback();
+    task.callback.Reset();
+    uint32_t run_us = esp_timer_get_time() - start_time;
+
+    schedule_executed_++;
+    schedule_wait_total_us_ += wait_us;
+    if (wait_us > schedule_wait_max_us_) {
+        schedule_wait_max_us_ = wait_us;
+    }
+    if (run_us > schedule_run_max_us_) {
+        schedule_run_max_us_ = run_us;
+    }
+}
+
+void Application::LogScheduleStats() {
+    uint32_t executed = schedule_executed_.exchange(0);
+    uint32_t overflows = schedule_overflows_.exchange(0);
+    uint32_t wait_total = schedule_wait_total_us_.exchange(0);
+    uint32_t wait_max = schedule_wait_max_us_.exchange(0);
+    uint32_t run_max = schedule_run_max_us_.exchange(0);
+    if (executed > 0) {
+        ESP_LOGI(TAG, "Scheduled tasks: %lu run, wait %lu/%lu us (avg/max), run max %lu us",
+            executed, wait_total / executed, wait_max, run_max);
+    }
+    if (overflows > 0) {
+        ESP_LOGW(TAG, "Schedule queue full, %lu tasks went to the overflow list", overflows);
+    }
+}
+
 // The Main Event Loop controls the chat state and websocket connection
 // If other tasks need to access the websocket or chat state,
 // they should use Schedule to call this function
@@ -769,145 +960,522 @@ void Application::MainEventLoop() {
     // Raise the priority of the main event loop to avoid being interrupted by background tasks (which has priority 2)
     vTaskPrioritySet(NULL, 3);
 
+#if CONFIG_USE_UPLINK_AGGREGATION
+    // Frames packed into one message, the slots keep their buffers
+    std::vector<AudioStreamPacket> batch(std::max(1, CONFIG_UPLINK_AGGREGATION_MAX_MS / OPUS_REALTIME_FRAME_DURATION_MS));
+#else
+    AudioStreamPacket packet;
+#endif
     while (true) {
         auto bits = xEventGroupWaitBits(event_group_, SCHEDULE_EVENT | SEND_AUDIO_EVENT, pdTRUE, pdFALSE, portMAX_DELAY);
 
         if (bits & SEND_AUDIO_EVENT) {
-            std::unique_lock<std::mutex> lock(mutex_);
-            auto packets = std::move(audio_send_queue_);
-            lock.unlock();
-            for (auto& packet : packets) {
+            auto dropped = audio_send_queue_.Trim(MAX_AUDIO_QUEUE_DURATION_MS / GetUplinkFrameDuration());
+            if (dropped > 0) {
+                ESP_LOGW(TAG, "Too many audio packets in queue, drop %u oldest packets", dropped);
+                audio_send_dropped_oldest_ += dropped;
+            }
+#if CONFIG_USE_UPLINK_AGGREGATION
+            // Only frames that are already waiting are packed together, none is held back for the next ones
+            size_t max_frames = std::min(batch.size(), (size_t)std::max(1, CONFIG_UPLINK_AGGREGATION_MAX_MS / GetUplinkFrameDuration()));
+            while (true) {
+                size_t count = 0;
+                while (count < max_frames && audio_send_queue_.Pop(batch[count])) {
+                    count++;
+                }
+                if (count == 0) {
+                    break;
+                }
+                if (!protocol_->SendAudioFrames(batch.data(), count)) {
+                    audio_send_failures_++;
+                    audio_send_queue_.Trim(0);
+                    break;
+                }
+                LatencyTracer::GetInstance().Mark(kLatencyFirstSendAudio);
+            }
+#else
+            while (audio_send_queue_.Pop(packet)) {
                 if (!protocol_->SendAudio(packet)) {
+                    audio_send_failures_++;
+                    audio_send_queue_.Trim(0);
                     break;
                 }
+                LatencyTracer::GetInstance().Mark(kLatencyFirstSendAudio);
             }
+#endif
         }
 
         if (bits & SCHEDULE_EVENT) {
-            std::unique_lock<std::mutex> lock(mutex_);
-            auto tasks = std::move(main_tasks_);
-            lock.unlock();
-            for (auto& task : tasks) {
-                task();
+            RunMainTasks();
+        }
+    }
+}
+
+// Called from Start() and then only from the encode task
+void Application::CreateEncoder(int frame_duration) {
+    opus_encoder_ = std::make_unique<OpusVoiceEncoder>(16000, 1, frame_duration, AUDIO_PACKET_HEADROOM);
+    opus_encoder_->SetComplexity(encoder_controller_.complexity());
+    opus_encoder_->SetBitrate(encoder_controller_.bitrate());
+    opus_encoder_frame_duration_ = frame_duration;
+    encoder_complexity_ = opus_encoder_->complexity();
+    encoder_bitrate_ = opus_encoder_->bitrate();
+    ESP_LOGI(TAG, "Opus encoder: %d ms frames, complexity %d, bitrate %d", frame_duration,
+        opus_encoder_->complexity(), opus_encoder_->bitrate());
+}
+
+// Encode task only, applies the operating point chosen for the last control window
+void Application::AdjustEncoder(const EncoderLoadSample& sample) {
+    bool changed = encoder_controller_.Update(sample);
+    encoder_cpu_percent_ = encoder_controller_.cpu_percent();
+    if (!changed) {
+        return;
+    }
+    opus_encoder_->SetComplexity(encoder_controller_.complexity());
+    opus_encoder_->SetBitrate(encoder_controller_.bitrate());
+    encoder_complexity_ = opus_encoder_->complexity();
+    encoder_bitrate_ = opus_encoder_->bitrate();
+    ESP_LOGI(TAG, "Opus encoder: complexity %d, bitrate %d (cpu %d%%, queue %d/%d, dropped %lu, send failures %lu)",
+        opus_encoder_->complexity(), opus_encoder_->bitrate(), encoder_controller_.cpu_percent(),
+        sample.queue_depth, sample.queue_limit, sample.drops, sample.send_failures);
+}
+
+// Called from the audio processor and the audio loop, the encode task is the only consumer
+void Application::PushEncodeQueue(std::vector<int16_t>&& pcm, bool testing) {
+    {
+        std::lock_guard<std::mutex> lock(audio_encode_mutex_);
+        AudioEncodeFrame frame;
+        frame.pcm = std::move(pcm);
+        frame.testing = testing;
+        if (!audio_encode_queue_.Push(std::move(frame))) {
+            ESP_LOGW(TAG, "Audio encode queue overflow, drop the newest frame");
+            audio_send_dropped_newest_++;
+            return;
+        }
+    }
+    if (audio_encode_task_handle_ != nullptr) {
+        xTaskNotifyGive(audio_encode_task_handle_);
+    }
+}
+
+void Application::AudioEncodeLoop() {
+    // Load seen by the encoder in the current control window
+    EncoderLoadSample window = {};
+    int64_t window_start = esp_timer_get_time();
+    uint32_t drops_before = 0;
+    uint32_t send_failures_before = 0;
+
+    // Packets go into the send queue by swapping, so the buffers circulate between the
+    // encoder, the queue and the main loop instead of being allocated per frame. The
+    // handler is built once here, the silence suppressor takes it as a std::function
+    AudioStreamPacket packet;
+    const std::function<void(std::vector<uint8_t>& opus)> send_packet = [this, &window, &packet](std::vector<uint8_t>& opus) {
+        window.frames++;
+        packet.payload.swap(opus);
+        packet.headroom = AUDIO_PACKET_HEADROOM;
+#ifdef CONFIG_USE_SERVER_AEC
+        packet.timestamp = playback_clock_.Now();
+#else
+        packet.timestamp = 0;
+#endif
+        // The main loop trims the queue to MAX_AUDIO_QUEUE_DURATION_MS, dropping the oldest packets
+        if (!audio_send_queue_.Push(std::move(packet))) {
+            ESP_LOGW(TAG, "Audio send queue overflow, drop the newest packet");
+            audio_send_dropped_newest_++;
+        }
+        xEventGroupSetBits(event_group_, SEND_AUDIO_EVENT);
+    };
+
+#if CONFIG_USE_AUDIO_DTX
+    // Realtime sessions stream the microphone all the time, their silence is thinned out
+    bool uplink_dtx = false;
+    auto suppress_packet = [this, &send_packet](std::vector<uint8_t>& opus) {
+        silence_suppressor_.Process(opus, uplink_voice_, opus_encoder_frame_duration_, send_packet);
+    };
+#endif
+
+    AudioEncodeFrame frame;
+    while (true) {
+        if (audio_encoder_reset_.exchange(false)) {
+            // A new session may use a different frame duration
+            int frame_duration = GetUplinkFrameDuration();
+            if (frame_duration != opus_encoder_frame_duration_) {
+                CreateEncoder(frame_duration);
+            } else {
+                opus_encoder_->ResetState();
+            }
+#if CONFIG_USE_AUDIO_DTX
+            uplink_dtx = listening_mode_ == kListeningModeRealtime;
+            silence_suppressor_.Reset(send_packet);
+#endif
+        }
+        if (preroll_flush_.exchange(false)) {
+            std::vector<int16_t> pcm;
+            preroll_.Read(pcm);
+            if (!pcm.empty()) {
+                ESP_LOGI(TAG, "Sending %u ms of pre-roll audio", pcm.size() * 1000 / 16000);
+                int64_t start = esp_timer_get_time();
+                opus_encoder_->Encode(std::move(pcm), send_packet);
+                window.encode_us += esp_timer_get_time() - start;
             }
         }
+        if (!audio_encode_queue_.Pop(frame)) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        if (frame.testing) {
+            opus_encoder_->Encode(std::move(frame.pcm), [this](std::vector<uint8_t>& opus) {
+                AudioStreamPacket packet;
+                // Played back through the decoder, which takes the bare Opus packet
+                packet.payload.assign(opus.begin() + AUDIO_PACKET_HEADROOM, opus.end());
+                packet.frame_duration = opus_encoder_frame_duration_;
+                packet.sample_rate = 16000;
+                std::lock_guard<std::mutex> lock(mutex_);
+                audio_testing_queue_.push_back(std::move(packet));
+            });
+            continue;
+        }
+
+        int64_t start = esp_timer_get_time();
+#if CONFIG_USE_AUDIO_DTX
+        if (uplink_dtx) {
+            opus_encoder_->Encode(std::move(frame.pcm), suppress_packet);
+        } else {
+            opus_encoder_->Encode(std::move(frame.pcm), send_packet);
+        }
+#else
+        opus_encoder_->Encode(std::move(frame.pcm), send_packet);
+#endif
+        int64_t now = esp_timer_get_time();
+        window.encode_us += now - start;
+
+        if (now - window_start >= ENCODER_CONTROL_WINDOW_MS * 1000) {
+            uint32_t drops = audio_send_dropped_newest_ + audio_send_dropped_oldest_;
+            uint32_t send_failures = audio_send_failures_;
+            window.frame_duration_ms = opus_encoder_frame_duration_;
+            window.queue_depth = audio_send_queue_.Size();
+            window.queue_limit = MAX_AUDIO_QUEUE_DURATION_MS / opus_encoder_frame_duration_;
+            window.drops = drops - drops_before;
+            window.send_failures = send_failures - send_failures_before;
+            AdjustEncoder(window);
+
+            window = {};
+            window_start = now;
+            drops_before = drops;
+            send_failures_before = send_failures;
+        }
     }
 }
 
-// The Audio Loop is used to input and output audio data
+// The Audio Loop is used to input audio data, the output runs in the decode and output tasks
 void Application::AudioLoop() {
-    auto codec = Board::GetInstance().GetAudioCodec();
     while (true) {
         OnAudioInput();
-        if (codec->output_enabled()) {
-            OnAudioOutput();
+    }
+}
+
+// Keeps up to CONFIG_AUDIO_DECODE_AHEAD_FRAMES decoded frames ready for the output task
+void Application::AudioDecodeLoop() {
+#if CONFIG_USE_SOUND_PCM_CACHE
+    // Decoded here because the decode task has the stack for it
+    int sample_rate = Board::GetInstance().GetAudioCodec()->output_sample_rate();
+    sound_cache_.Add(Lang::Sounds::P3_POPUP, sample_rate);
+    sound_cache_.Add(Lang::Sounds::P3_SUCCESS, sample_rate);
+    sound_cache_.Add(Lang::Sounds::P3_EXCLAMATION, sample_rate);
+    sound_cache_ready_ = true;
+#endif
+    while (true) {
+        if (!DecodeAudio()) {
+            // Woken up by new packets or free PCM slots, the timeout lets the jitter buffer release held back packets
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
         }
     }
 }
 
-void Application::OnAudioOutput() {
-    if (busy_decoding_audio_) {
+bool Application::DecodeAudio() {
+    auto codec = Board::GetInstance().GetAudioCodec();
+    if (!codec->output_enabled() || audio_pcm_queue_.Size() >= CONFIG_AUDIO_DECODE_AHEAD_FRAMES) {
+        return false;
+    }
+
+    if (audio_decoder_reset_.exchange(false)) {
+        opus_decoder_->ResetState();
+        drift_compensator_.Reset();
+    }
+    if (audio_testing_playback_) {
+        FeedAudioTestingPlayback();
+    }
+
+    // Local sounds take precedence over the audio from the server
+    auto& packet = audio_decode_packet_;
+    const uint8_t* sound_payload = nullptr;
+    size_t sound_size = 0;
+    const CachedSound* cue = nullptr;
+    bool audio_testing = false;
+    bool lost = false;
+    if (NextSoundFrame(sound_payload, sound_size, cue)) {
+        packet.sample_rate = 16000;
+        packet.frame_duration = 60;
+        packet.timestamp = 0;
+    } else if (audio_decode_queue_.Pop(packet)) {
+        audio_testing = true;
+    } else {
+        auto result = jitter_buffer_.Get(packet);
+        if (result == kJitterBufferEmpty) {
+            return false;
+        }
+        lost = result == kJitterBufferLost;
+    }
+    if (aborted_) {
+        return true;
+    }
+
+    auto& frame = audio_decode_frame_;
+    if (cue != nullptr) {
+        // In order with the other audio, the output task writes the cached PCM directly
+        frame.cue = cue;
+        frame.timestamp = 0;
+        frame.from_server = false;
+        audio_pcm_queue_.Push(std::move(frame));
+        if (audio_output_task_handle_ != nullptr) {
+            xTaskNotifyGive(audio_output_task_handle_);
+        }
+        return true;
+    }
+    frame.cue = nullptr;
+
+    // Synchronize the sample rate and frame duration
+    SetDecodeSampleRate(packet.sample_rate, packet.frame_duration);
+
+    int64_t start_time = esp_timer_get_time();
+    if (sound_payload != nullptr) {
+        // Decoded straight from the embedded sound, without copying the frame
+        if (!opus_decoder_->Decode(sound_payload, sound_size, frame.pcm)) {
+            return true;
+        }
+    } else if (lost) {
+        // Rebuild the missing frame from the FEC data in the next packet, or conceal it
+        if (!opus_decoder_->DecodeLost(packet.payload, frame.pcm)) {
+            return true;
+        }
+    } else if (!opus_decoder_->Decode(packet.payload, frame.pcm)) {
+        return true;
+    }
+    if (sound_payload == nullptr && !audio_testing && !lost && protocol_) {
+        // The next incoming packet reuses the buffer instead of allocating one
+        protocol_->ReleaseAudioBuffer(packet.payload);
+    }
+    // Resample if the sample rate is different
+    if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
+        audio_resample_buffer_.resize(output_resampler_.GetOutputSamples(frame.pcm.size()));
+        output_resampler_.Process(frame.pcm.data(), frame.pcm.size(), audio_resample_buffer_.data());
+        std::swap(frame.pcm, audio_resample_buffer_);
+    }
+    if (aborted_) {
+        // Aborted while decoding, the frame must not reach the speaker
+        return true;
+    }
+    frame.timestamp = packet.timestamp;
+    frame.from_server = sound_payload == nullptr && !audio_testing;
+    if (frame.from_server) {
+        LatencyTracer::GetInstance().Mark(kLatencyFirstDecodedFrame);
+        // Concealed frames never arrived, they have no arrival time
+        if (packet.arrival_time != 0) {
+            drift_compensator_.Update(packet.sequence, packet.arrival_time, packet.frame_duration);
+        }
+        drift_compensator_.Process(frame.pcm);
+    }
+
+    // Bucket i counts frames that took less than 2^i ms, the last bucket everything slower
+    int elapsed_ms = (esp_timer_get_time() - start_time) / 1000;
+    int bucket = 0;
+    while (bucket < AUDIO_DECODE_HISTOGRAM_BUCKETS - 1 && elapsed_ms >= (1 << bucket)) {
+        bucket++;
+    }
+    audio_decode_histogram_[bucket]++;
+    audio_decoded_frames_++;
+
+    // Swapped into the queue, the frame comes back with the buffer of a played frame
+    audio_pcm_queue_.Push(std::move(frame));
+    if (audio_output_task_handle_ != nullptr) {
+        xTaskNotifyGive(audio_output_task_handle_);
+    }
+    return true;
+}
+
+// Called by the output task, so the main loop never waits for the reply to play out
+void Application::CheckPlaybackDrained() {
+    if (playback_drain_state_ != kPlaybackDrainWaiting) {
+        return;
+    }
+    bool drained = audio_decode_queue_.Empty() && jitter_buffer_.Size() == 0 && audio_pcm_queue_.Empty();
+    if (!drained && esp_timer_get_time() - playback_drain_start_ < PLAYBACK_DRAIN_TIMEOUT_MS * 1000LL) {
         return;
     }
+    int expected = kPlaybackDrainWaiting;
+    if (playback_drain_state_.compare_exchange_strong(expected, kPlaybackDrainDone)) {
+        Schedule([this]() {
+            OnPlaybackDrained();
+        });
+    }
+}
 
+void Application::OnPlaybackDrained() {
+    int expected = kPlaybackDrainDone;
+    if (!playback_drain_state_.compare_exchange_strong(expected, kPlaybackDrainIdle)) {
+        // A new reply started in the meantime
+        return;
+    }
+    auto stats = jitter_buffer_.GetStats();
+    ESP_LOGI(TAG, "Jitter buffer: depth %d/%d, jitter %d ms, late %lu, lost %lu (fec %lu, plc %lu), reordered %lu, underruns %lu",
+        stats.depth, stats.target_depth, stats.jitter_ms, stats.late, stats.lost,
+        opus_decoder_->fec_frames(), opus_decoder_->plc_frames(), stats.reordered, stats.underruns);
+    ESP_LOGI(TAG, "Drift compensation: %d ppm, %ld samples adjusted",
+        drift_compensator_.ppm(), drift_compensator_.adjusted_samples());
+    auto playback = GetAudioPlaybackStats();
+    ESP_LOGI(TAG, "Playback: %lu frames, %lu underruns, decode ms <1:%lu <2:%lu <4:%lu <8:%lu <16:%lu <32:%lu >=32:%lu",
+        playback.frames, playback.underruns, playback.decode_time_histogram[0], playback.decode_time_histogram[1],
+        playback.decode_time_histogram[2], playback.decode_time_histogram[3], playback.decode_time_histogram[4],
+        playback.decode_time_histogram[5], playback.decode_time_histogram[6]);
+    if (device_state_ == kDeviceStateSpeaking) {
+        if (listening_mode_ == kListeningModeManualStop) {
+            SetDeviceState(kDeviceStateIdle);
+        } else {
+            SetDeviceState(kDeviceStateListening);
+        }
+    }
+}
+
+// Writes the decoded frames to the codec, paced by the I2S output
+void Application::AudioOutputLoop() {
+    auto codec = Board::GetInstance().GetAudioCodec();
+    while (true) {
+        CheckPlaybackDrained();
+        if (!codec->output_enabled()) {
+            audio_output_playing_ = false;
+            playback_clock_.Reset();
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(OPUS_FRAME_DURATION_MS / 2));
+            continue;
+        }
+        OnAudioOutput();
+    }
+}
+
+void Application::OnAudioOutput() {
     auto now = std::chrono::steady_clock::now();
     auto codec = Board::GetInstance().GetAudioCodec();
     const int max_silence_seconds = 10;
 
-    std::unique_lock<std::mutex> lock(mutex_);
-    if (audio_decode_queue_.empty()) {
+#if CONFIG_USE_LOCAL_BARGE_IN
+    if (audio_output_flush_.exchange(false)) {
+        codec->FlushOutput();
+        audio_pcm_queue_.Clear();
+        int elapsed_ms = (esp_timer_get_time() - barge_in_time_) / 1000;
+        if (elapsed_ms > BARGE_IN_SILENCE_TARGET_MS) {
+            ESP_LOGW(TAG, "Barge-in: speaker silent %d ms after the barge-in, target %d ms", elapsed_ms, BARGE_IN_SILENCE_TARGET_MS);
+        } else {
+            ESP_LOGI(TAG, "Barge-in: speaker silent %d ms after the barge-in", elapsed_ms);
+        }
+        return;
+    }
+#endif
+
+    auto& frame = audio_output_frame_;
+    if (!audio_pcm_queue_.Pop(frame)) {
+        playback_clock_.Stop();
+        if (audio_output_playing_) {
+            audio_output_playing_ = false;
+            // Running dry while packets are still waiting means the decoder fell behind
+            if (!audio_decode_queue_.Empty() || jitter_buffer_.Size() > 0) {
+                audio_output_underruns_++;
+            }
+        }
         // Disable the output if there is no audio data for a long time
         if (device_state_ == kDeviceStateIdle) {
             auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - last_output_time_).count();
             if (duration > max_silence_seconds) {
                 codec->EnableOutput(false);
+                return;
             }
         }
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(OPUS_FRAME_DURATION_MS / 2));
         return;
     }
 
-    auto packet = std::move(audio_decode_queue_.front());
-    audio_decode_queue_.pop_front();
-    lock.unlock();
-    audio_decode_cv_.notify_all();
-
-    // Synchronize the sample rate and frame duration
-    SetDecodeSampleRate(packet.sample_rate, packet.frame_duration);
-
-    busy_decoding_audio_ = true;
-    if (!background_task_->Schedule([this, codec, packet = std::move(packet)]() mutable {
-        busy_decoding_audio_ = false;
-        if (aborted_) {
-            return;
-        }
-
-        std::vector<int16_t> pcm;
-        if (!opus_decoder_->Decode(std::move(packet.payload), pcm)) {
-            return;
-        }
-        // Resample if the sample rate is different
-        if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
-            int target_size = output_resampler_.GetOutputSamples(pcm.size());
-            std::vector<int16_t> resampled(target_size);
-            output_resampler_.Process(pcm.data(), pcm.size(), resampled.data());
-            pcm = std::move(resampled);
-        }
-        codec->OutputData(pcm);
-#ifdef CONFIG_USE_SERVER_AEC
-        std::lock_guard<std::mutex> lock(timestamp_mutex_);
-        timestamp_queue_.push_back(packet.timestamp);
-#endif
+    // A slot is free again, let the decoder fill it
+    if (audio_decode_task_handle_ != nullptr) {
+        xTaskNotifyGive(audio_decode_task_handle_);
+    }
+    audio_output_playing_ = true;
+#if CONFIG_USE_SOUND_PCM_CACHE
+    if (frame.cue != nullptr) {
+        ESP_LOGI(TAG, "Cue sound started after %ld us", (int32_t)(esp_timer_get_time() - cue_request_time_));
+        codec->OutputData(frame.cue->samples, frame.cue->size);
+        playback_clock_.Advance(0, frame.cue->size, codec->output_sample_rate());
         last_output_time_ = std::chrono::steady_clock::now();
-    })) {
-        busy_decoding_audio_ = false;
+        return;
     }
+#endif
+    codec->OutputData(frame.pcm);
+    playback_clock_.Advance(frame.timestamp, frame.pcm.size(), codec->output_sample_rate());
+    if (frame.from_server) {
+        LatencyTracer::GetInstance().Mark(kLatencyFirstOutput);
+    }
+    last_output_time_ = std::chrono::steady_clock::now();
 }
 
 void Application::OnAudioInput() {
     if (device_state_ == kDeviceStateAudioTesting) {
-        if (audio_testing_queue_.size() >= AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS) {
+        if (audio_testing_queue_.size() >= AUDIO_TESTING_MAX_DURATION_MS / GetUplinkFrameDuration()) {
             ExitAudioTestingMode();
             return;
         }
         std::vector<int16_t> data;
         int samples = OPUS_FRAME_DURATION_MS * 16000 / 1000;
         if (ReadAudio(data, 16000, samples)) {
-            background_task_->Schedule([this, data = std::move(data)]() mutable {
-                opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
-                    AudioStreamPacket packet;
-                    packet.payload = std::move(opus);
-                    packet.frame_duration = OPUS_FRAME_DURATION_MS;
-                    packet.sample_rate = 16000;
-                    std::lock_guard<std::mutex> lock(mutex_);
-                    audio_testing_queue_.push_back(std::move(packet));
-                });
-            });
+            PushEncodeQueue(std::move(data), true);
             return;
         }
     }
 
     if (wake_word_->IsDetectionRunning()) {
-        std::vector<int16_t> data;
         int samples = wake_word_->GetFeedSize();
         if (samples > 0) {
-            if (ReadAudio(data, 16000, samples)) {
-                wake_word_->Feed(data);
+            if (ReadAudio(input_data_, 16000, samples)) {
+                wake_word_->Feed(input_data_);
+#if CONFIG_AUDIO_PREROLL_DURATION_MS > 0
+                if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateConnecting) {
+                    auto codec = Board::GetInstance().GetAudioCodec();
+                    preroll_.Write(input_data_.data(), input_data_.size(), codec->input_channels());
+                }
+#endif
                 return;
             }
         }
     }
 
     if (audio_processor_->IsRunning()) {
-        std::vector<int16_t> data;
         int samples = audio_processor_->GetFeedSize();
         if (samples > 0) {
-            if (ReadAudio(data, 16000, samples)) {
-                audio_processor_->Feed(data);
+            if (ReadAudio(input_data_, 16000, samples)) {
+                audio_processor_->Feed(input_data_);
                 return;
             }
         }
     }
 
+#if CONFIG_AUDIO_PREROLL_DURATION_MS > 0
+    // Nothing else reads the microphone while the channel opens after a wake word
+    if (device_state_ == kDeviceStateConnecting) {
+        auto codec = Board::GetInstance().GetAudioCodec();
+        int samples = 30 * 16000 / 1000 * codec->input_channels();
+        if (ReadAudio(input_data_, 16000, samples)) {
+            preroll_.Write(input_data_.data(), input_data_.size(), codec->input_channels());
+            return;
+        }
+    }
+#endif
+
     vTaskDelay(pdMS_TO_TICKS(OPUS_FRAME_DURATION_MS / 2));
 }
 
@@ -917,31 +1485,31 @@ bool Application::ReadAudio(std::vector<int16_t>& data, int sample_rate, int sam
         return false;
     }
 
+    // The scratch buffers keep their capacity, so nothing is allocated once they have grown to the frame size
     if (codec->input_sample_rate() != sample_rate) {
-        data.resize(samples * codec->input_sample_rate() / sample_rate);
-        if (!codec->InputData(data)) {
+        int input_samples = samples * codec->input_sample_rate() / sample_rate;
+        GrowInputBuffer(input_capture_, input_samples);
+        if (!codec->InputData(input_capture_.data(), input_samples)) {
             return false;
         }
         if (codec->input_channels() == 2) {
-            auto mic_channel = std::vector<int16_t>(data.size() / 2);
-            auto reference_channel = std::vector<int16_t>(data.size() / 2);
-            for (size_t i = 0, j = 0; i < mic_channel.size(); ++i, j += 2) {
-                mic_channel[i] = data[j];
-                reference_channel[i] = data[j + 1];
-            }
-            auto resampled_mic = std::vector<int16_t>(input_resampler_.GetOutputSamples(mic_channel.size()));
-            auto resampled_reference = std::vector<int16_t>(reference_resampler_.GetOutputSamples(reference_channel.size()));
-            input_resampler_.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
-            reference_resampler_.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
-            data.resize(resampled_mic.size() + resampled_reference.size());
-            for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
-                data[j] = resampled_mic[i];
-                data[j + 1] = resampled_reference[i];
-            }
+            int frames = input_samples / 2;
+            GrowInputBuffer(input_mic_, frames);
+            GrowInputBuffer(input_reference_, frames);
+            PcmDeinterleave(input_capture_.data(), input_mic_.data(), input_reference_.data(), frames);
+
+            int resampled_frames = input_resampler_.GetOutputSamples(frames);
+            GrowInputBuffer(resampled_mic_, resampled_frames);
+            GrowInputBuffer(resampled_reference_, reference_resampler_.GetOutputSamples(frames));
+            input_resampler_.Process(input_mic_.data(), frames, resampled_mic_.data());
+            reference_resampler_.Process(input_reference_.data(), frames, resampled_reference_.data());
+            data.resize(resampled_frames * 2);
+            PcmInterleave(resampled_mic_.data(), resampled_reference_.data(), data.data(), resampled_frames);
         } else {
-            auto resampled = std::vector<int16_t>(input_resampler_.GetOutputSamples(data.size()));
-            input_resampler_.Process(data.data(), data.size(), resampled.data());
-            data = std::move(resampled);
+            int resampled_samples = input_resampler_.GetOutputSamples(input_samples);
+            GrowInputBuffer(resampled_mic_, resampled_samples);
+            input_resampler_.Process(input_capture_.data(), input_samples, resampled_mic_.data());
+            data.assign(resampled_mic_.begin(), resampled_mic_.begin() + resampled_samples);
         }
     } else {
         data.resize(samples);
@@ -958,12 +1526,65 @@ bool Application::ReadAudio(std::vector<int16_t>& data, int sample_rate, int sam
     return true;
 }
 
+void Application::GrowInputBuffer(PcmBuffer& buffer, size_t samples) {
+    if (buffer.size() < samples) {
+        buffer.resize(samples);
+        input_buffer_grows_++;
+    }
+}
+
+#if CONFIG_USE_LOCAL_BARGE_IN
+// Called for every processed frame, so the voice is measured at the frame rate
+void Application::CheckBargeIn() {
+    int64_t voice_start = barge_in_voice_start_;
+    if (voice_start == 0) {
+        return;
+    }
+    if (device_state_ != kDeviceStateSpeaking) {
+        barge_in_voice_start_ = 0;
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    if (now - voice_start < CONFIG_BARGE_IN_MIN_SPEECH_MS * 1000LL) {
+        return;
+    }
+    barge_in_voice_start_ = 0;
+    barge_in_time_ = now;
+    Schedule([this]() {
+        BargeIn();
+    });
+}
+
+void Application::BargeIn() {
+    if (device_state_ != kDeviceStateSpeaking || aborted_) {
+        return;
+    }
+    ESP_LOGI(TAG, "Barge-in detected");
+    // Silence the speaker first, the server is told afterwards
+    aborted_ = true;
+    jitter_buffer_.Reset();
+    audio_pcm_queue_.Clear();
+    audio_output_flush_ = true;
+    if (audio_output_task_handle_ != nullptr) {
+        xTaskNotifyGive(audio_output_task_handle_);
+    }
+    AbortSpeaking(kAbortReasonNone);
+}
+#endif
+
 void Application::AbortSpeaking(AbortReason reason) {
     ESP_LOGI(TAG, "Abort speaking");
     aborted_ = true;
     protocol_->SendAbortSpeaking(reason);
 }
 
+// Only realtime sessions send the shorter frames. The hello message announces the frame duration,
+// so a channel keeps it for every turn, including turns in another mode on the same channel
+bool Application::OpenAudioChannel(ListeningMode mode) {
+    uplink_frame_duration_ = mode == kListeningModeRealtime ? OPUS_REALTIME_FRAME_DURATION_MS : OPUS_FRAME_DURATION_MS;
+    return protocol_->OpenAudioChannel();
+}
+
 void Application::SetListeningMode(ListeningMode mode) {
     listening_mode_ = mode;
     SetDeviceState(kDeviceStateListening);
@@ -976,10 +1597,14 @@ void Application::SetDeviceState(DeviceState state) {
     
     clock_ticks_ = 0;
     auto previous_state = device_state_;
+#if CONFIG_USE_SPECULATIVE_CHANNEL_OPEN
+    // Leaving idle on an already open channel is what the speculative open was for
+    if (state != kDeviceStateIdle) {
+        ClaimSpeculativeChannel(!protocol_ || !protocol_->IsAudioChannelOpened());
+    }
+#endif
     device_state_ = state;
     ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[device_state_]);
-    // The state is changed, wait for all background tasks to finish
-    background_task_->WaitForCompletion();
 
     auto& board = Board::GetInstance();
     auto display = board.GetDisplay();
@@ -997,7 +1622,7 @@ void Application::SetDeviceState(DeviceState state) {
             display->SetStatus(Lang::Strings::CONNECTING);
             display->SetEmotion("neutral");
             display->SetChatMessage("system", "");
-            timestamp_queue_.clear();
+            playback_clock_.Reset();
             break;
         case kDeviceStateListening:
             display->SetStatus(Lang::Strings::LISTENING);
@@ -1012,12 +1637,25 @@ void Application::SetDeviceState(DeviceState state) {
                 // Send the start listening command
                 protocol_->SendStartListening(listening_mode_);
                 if (previous_state == kDeviceStateSpeaking) {
-                    audio_decode_queue_.clear();
-                    audio_decode_cv_.notify_all();
+                    LatencyTracer::GetInstance().BeginTurn();
+                    audio_decode_queue_.Clear();
+                    jitter_buffer_.Reset();
+                    audio_pcm_queue_.Clear();
                     // FIXME: Wait for the speaker to empty the buffer
                     vTaskDelay(pdMS_TO_TICKS(120));
                 }
-                opus_encoder_->ResetState();
+                // Frames left from the previous turn are dropped, and the encode task resets the encoder
+                audio_encode_queue_.Clear();
+                audio_encoder_reset_ = true;
+                // What was said while the channel opened goes out ahead of the live audio
+                if (previous_state == kDeviceStateIdle || previous_state == kDeviceStateConnecting) {
+                    preroll_flush_ = true;
+                    if (audio_encode_task_handle_ != nullptr) {
+                        xTaskNotifyGive(audio_encode_task_handle_);
+                    }
+                } else {
+                    preroll_.Clear();
+                }
                 audio_processor_->Start();
                 wake_word_->StopDetection();
             }
@@ -1042,11 +1680,56 @@ void Application::SetDeviceState(DeviceState state) {
     }
 }
 
+#if CONFIG_USE_SPECULATIVE_CHANNEL_OPEN
+void Application::OpenSpeculativeChannel() {
+    if (device_state_ != kDeviceStateIdle || speculative_channel_ || !protocol_ || protocol_->IsAudioChannelOpened()) {
+        return;
+    }
+    // After a wasted open, wait as long again so that a noisy room does not keep reconnecting
+    int64_t now = esp_timer_get_time();
+    if (speculative_closed_time_ != 0 &&
+        now - speculative_closed_time_ < CONFIG_SPECULATIVE_CHANNEL_IDLE_TIMEOUT_MS * 1000LL) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "Voice detected while idle, opening the audio channel");
+    speculative_open_time_ = now;
+    speculative_channel_ = true;
+    // Failures are reported through OnNetworkError
+    OpenAudioChannel(GetDefaultListeningMode());
+}
+
+void Application::CloseSpeculativeChannel() {
+    if (device_state_ != kDeviceStateIdle || !speculative_channel_) {
+        return;
+    }
+    ClaimSpeculativeChannel(true);
+    protocol_->CloseAudioChannel();
+}
+
+// Settles the outcome of a speculative open, if one is pending
+void Application::ClaimSpeculativeChannel(bool wasted) {
+    if (!speculative_channel_.exchange(false)) {
+        return;
+    }
+    if (wasted) {
+        speculative_wasted_++;
+        speculative_closed_time_ = esp_timer_get_time();
+    } else {
+        speculative_hits_++;
+    }
+    ESP_LOGI(TAG, "Speculative audio channel %s after %lld ms (hits %lu, wasted %lu)", wasted ? "wasted" : "used",
+        (esp_timer_get_time() - speculative_open_time_) / 1000, speculative_hits_, speculative_wasted_);
+}
+#endif
+
 void Application::ResetDecoder() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    opus_decoder_->ResetState();
-    audio_decode_queue_.clear();
-    audio_decode_cv_.notify_all();
+    // The decoder belongs to the decode task, which resets it before the next frame
+    audio_decoder_reset_ = true;
+    audio_decode_queue_.Clear();
+    jitter_buffer_.Reset();
+    audio_pcm_queue_.Clear();
+    sound_generation_++;
     last_output_time_ = std::chrono::steady_clock::now();
     auto codec = Board::GetInstance().GetAudioCodec();
     codec->EnableOutput(true);
@@ -1058,7 +1741,7 @@ void Application::SetDecodeSampleRate(int sample_rate, int frame_duration) {
     }
 
     opus_decoder_.reset();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(sample_rate, 1, frame_duration);
+    opus_decoder_ = std::make_unique<OpusFecDecoder>(sample_rate, 1, frame_duration);
 
     auto codec = Board::GetInstance().GetAudioCodec();
     if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
@@ -1067,6 +1750,40 @@ void Application::SetDecodeSampleRate(int sample_rate, int frame_duration) {
     }
 }
 
+AudioPlaybackStats Application::GetAudioPlaybackStats() const {
+    AudioPlaybackStats stats;
+    stats.frames = audio_decoded_frames_.load();
+    stats.underruns = audio_output_underruns_.load();
+    for (int i = 0; i < AUDIO_DECODE_HISTOGRAM_BUCKETS; i++) {
+        stats.decode_time_histogram[i] = audio_decode_histogram_[i].load();
+    }
+    return stats;
+}
+
+AudioQueueStats Application::GetAudioQueueStats() {
+    return AudioQueueStats{
+        .decode_dropped = jitter_buffer_.GetStats().overflows,
+        .send_dropped_newest = audio_send_dropped_newest_.load(),
+        .send_dropped_oldest = audio_send_dropped_oldest_.load(),
+    };
+}
+
+AudioEncoderStatus Application::GetAudioEncoderStatus() const {
+    return AudioEncoderStatus{
+        .frame_duration = opus_encoder_frame_duration_.load(),
+        .complexity = encoder_complexity_.load(),
+        .bitrate = encoder_bitrate_.load(),
+        .cpu_percent = encoder_cpu_percent_.load(),
+#if CONFIG_USE_AUDIO_DTX
+        .dtx_saved_percent = silence_suppressor_.saved_percent(),
+        .dtx_marker_delay_ms = CONFIG_AUDIO_DTX_LOOKBACK_MS,
+#else
+        .dtx_saved_percent = 0,
+        .dtx_marker_delay_ms = 0,
+#endif
+    };
+}
+
 void Application::UpdateIotStates() {
 #if CONFIG_IOT_PROTOCOL_XIAOZHI
     auto& thing_manager = iot::ThingManager::GetInstance();
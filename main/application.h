@@ -9,20 +9,33 @@
 #include <string>
 #include <mutex>
 #include <list>
+#include <functional>
 #include <vector>
 #include <condition_variable>
 #include <memory>
+#include <atomic>
 
 #include <opus_encoder.h>
-#include <opus_decoder.h>
 #include <opus_resampler.h>
 
 #include "protocol.h"
 #include "ota.h"
-#include "background_task.h"
 #include "audio_processor.h"
 #include "wake_word.h"
 #include "audio_debugger.h"
+#include "spsc_queue.h"
+#include "mpsc_queue.h"
+#include "inline_callback.h"
+#include "jitter_buffer.h"
+#include "opus_fec_decoder.h"
+#include "opus_voice_encoder.h"
+#include "encoder_rate_controller.h"
+#include "pcm_interleave.h"
+#include "sound_pcm_cache.h"
+#include "preroll_buffer.h"
+#include "playback_clock.h"
+#include "drift_compensator.h"
+#include "silence_suppressor.h"
 
 #define SCHEDULE_EVENT (1 << 0)
 #define SEND_AUDIO_EVENT (1 << 1)
@@ -48,9 +61,86 @@ enum DeviceState {
     kDeviceStateFatalError
 };
 
+// Uplink Opus frame duration of turn-based sessions, longer frames cost less CPU and radio time
 #define OPUS_FRAME_DURATION_MS 60
-#define MAX_AUDIO_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
+// Uplink Opus frame duration of realtime sessions, shorter frames reach the server sooner
+#define OPUS_REALTIME_FRAME_DURATION_MS 20
+// Frame duration of the TTS audio from the server, the downlink buffers are sized for it
+#define SERVER_FRAME_DURATION_MS 60
+// Audio held by the send queue and the jitter buffer at most
+#define MAX_AUDIO_QUEUE_DURATION_MS 2400
+// Downlink queue slots, enough for MAX_AUDIO_QUEUE_DURATION_MS of server frames
+#define MAX_AUDIO_PACKETS_IN_QUEUE (MAX_AUDIO_QUEUE_DURATION_MS / SERVER_FRAME_DURATION_MS)
+// Send queue slots, enough for MAX_AUDIO_QUEUE_DURATION_MS of the shortest uplink frames
+#define MAX_SEND_PACKETS_IN_QUEUE (MAX_AUDIO_QUEUE_DURATION_MS / OPUS_REALTIME_FRAME_DURATION_MS)
 #define AUDIO_TESTING_MAX_DURATION_MS 10000
+// Captures of a Schedule() callable must fit in this many bytes
+#define SCHEDULE_CALLBACK_SIZE 64
+#define MAX_SCHEDULED_TASKS 32
+// Scheduled tasks that wait longer than this before running are logged
+#define SCHEDULE_SLOW_WAIT_US 100000
+
+struct ScheduledTask {
+    InlineCallback<SCHEDULE_CALLBACK_SIZE> callback;
+    int64_t schedule_time = 0;
+};
+
+#define AUDIO_DECODE_HISTOGRAM_BUCKETS 7
+// Longest wait for the buffered reply to play out after the server's tts stop
+#define PLAYBACK_DRAIN_TIMEOUT_MS 1000
+
+enum PlaybackDrainState {
+    kPlaybackDrainIdle,
+    kPlaybackDrainWaiting,      // The server stopped sending, the output task watches the buffers
+    kPlaybackDrainDone,         // The buffers ran dry, the main loop is about to leave speaking
+};
+
+struct AudioPlaybackStats {
+    uint32_t frames;                // Frames decoded
+    uint32_t underruns;             // The output ran dry while packets were still waiting to be decoded
+    uint32_t decode_time_histogram[AUDIO_DECODE_HISTOGRAM_BUCKETS]; // CPU time per frame: <1, <2, <4, ... <32, >=32 ms
+};
+
+struct AudioPcmFrame {
+    std::vector<int16_t> pcm;
+    uint32_t timestamp = 0;
+    bool from_server = false;
+    const CachedSound* cue = nullptr;   // Played from the PCM cache instead of pcm
+};
+
+#define MAX_QUEUED_SOUNDS 16
+
+// An embedded .p3 sound, referenced in place
+struct QueuedSound {
+    std::string_view data;
+    uint32_t generation = 0;        // Sounds from before the last ResetDecoder() are dropped
+    const CachedSound* cached = nullptr;    // Kept as PCM, played without the decoder
+};
+
+struct AudioEncodeFrame {
+    std::vector<int16_t> pcm;
+    bool testing = false;           // The packets go to the audio testing queue instead of the server
+};
+
+// The uplink encoder operating point is reconsidered this often
+#define ENCODER_CONTROL_WINDOW_MS 1000
+// Longest acceptable time from a confirmed barge-in to a silent speaker
+#define BARGE_IN_SILENCE_TARGET_MS 100
+
+struct AudioEncoderStatus {
+    int frame_duration;
+    int complexity;
+    int bitrate;
+    int cpu_percent;                // Encoder CPU time in percent of real time
+    int dtx_saved_percent;          // Encoded bytes not sent because of silence suppression
+    int dtx_marker_delay_ms;        // How much later the server sees silence because of the lookback
+};
+
+struct AudioQueueStats {
+    uint32_t decode_dropped;        // Incoming packets dropped because the jitter buffer was full
+    uint32_t send_dropped_newest;   // Captured frames dropped because the send queue was full
+    uint32_t send_dropped_oldest;   // Queued frames dropped to make room for newer ones
+};
 
 class Application {
 public:
@@ -65,23 +155,39 @@ public:
     void Start();
     DeviceState GetDeviceState() const { return device_state_; }
     bool IsVoiceDetected() const { return voice_detected_; }
-    void Schedule(std::function<void()> callback);
+    // Add an async task to the main loop, callable from any task
+    template <typename F>
+    void Schedule(F&& callback) {
+        ScheduledTask task;
+        task.callback.Assign(std::forward<F>(callback));
+        task.schedule_time = esp_timer_get_time();
+        PushMainTask(std::move(task));
+    }
     void SetDeviceState(DeviceState state);
     void Alert(const char* status, const char* message, const char* emotion = "", const std::string_view& sound = "");
     void DismissAlert();
     void AbortSpeaking(AbortReason reason);
+#if CONFIG_USE_LOCAL_BARGE_IN
+    void BargeIn();
+#endif
     void ToggleChatState();
     void StartListening();
     void StopListening();
     void UpdateIotStates();
     void Reboot();
     void WakeWordInvoke(const std::string& wake_word);
-    void PlaySound(const std::string_view& sound);
+    bool PlaySound(const std::string_view& sound);
     bool CanEnterSleepMode();
     void SendMcpMessage(const std::string& payload);
     void SetAecMode(AecMode mode);
     AecMode GetAecMode() const { return aec_mode_; }
-    BackgroundTask* GetBackgroundTask() const { return background_task_; }
+    // Frame duration of the audio sent to the server, announced in the hello message.
+    // It is fixed for the audio channel, see OpenAudioChannel()
+    int GetUplinkFrameDuration() const { return uplink_frame_duration_; }
+    AudioQueueStats GetAudioQueueStats();
+    JitterBufferStats GetJitterBufferStats() { return jitter_buffer_.GetStats(); }
+    AudioPlaybackStats GetAudioPlaybackStats() const;
+    AudioEncoderStatus GetAudioEncoderStatus() const;
 
 private:
     Application();
@@ -90,52 +196,176 @@ private:
     std::unique_ptr<WakeWord> wake_word_;
     std::unique_ptr<AudioProcessor> audio_processor_;
     std::unique_ptr<AudioDebugger> audio_debugger_;
+    // Guards audio_testing_queue_
     std::mutex mutex_;
-    std::list<std::function<void()>> main_tasks_;
+    MpscQueue<ScheduledTask> main_tasks_{MAX_SCHEDULED_TASKS};
+    // Tasks scheduled while main_tasks_ is full, they run after everything in it
+    std::mutex schedule_overflow_mutex_;
+    std::list<ScheduledTask> schedule_overflow_;
+    std::atomic<bool> schedule_overflow_pending_ = false;
+    // Queue latency of the scheduled tasks, reset every time they are logged
+    std::atomic<uint32_t> schedule_executed_ = 0;
+    std::atomic<uint32_t> schedule_overflows_ = 0;
+    std::atomic<uint32_t> schedule_wait_total_us_ = 0;
+    std::atomic<uint32_t> schedule_wait_max_us_ = 0;
+    std::atomic<uint32_t> schedule_run_max_us_ = 0;
     std::unique_ptr<Protocol> protocol_;
     EventGroupHandle_t event_group_ = nullptr;
     esp_timer_handle_t clock_timer_handle_ = nullptr;
     volatile DeviceState device_state_ = kDeviceStateUnknown;
     ListeningMode listening_mode_ = kListeningModeAutoStop;
     AecMode aec_mode_ = kAecOff;
+    std::atomic<int> uplink_frame_duration_ = OPUS_FRAME_DURATION_MS;
 
     bool has_server_time_ = false;
     bool aborted_ = false;
     bool voice_detected_ = false;
-    bool busy_decoding_audio_ = false;
     int clock_ticks_ = 0;
     TaskHandle_t check_new_version_task_handle_ = nullptr;
 
     // Audio encode / decode
     TaskHandle_t audio_loop_task_handle_ = nullptr;
-    BackgroundTask* background_task_ = nullptr;
+    TaskHandle_t audio_encode_task_handle_ = nullptr;
+    TaskHandle_t audio_decode_task_handle_ = nullptr;
+    TaskHandle_t audio_output_task_handle_ = nullptr;
     std::chrono::steady_clock::time_point last_output_time_;
-    std::list<AudioStreamPacket> audio_send_queue_;
-    std::list<AudioStreamPacket> audio_decode_queue_;
-    std::condition_variable audio_decode_cv_;
+    // The send queue is trimmed to MAX_AUDIO_QUEUE_DURATION_MS of packets at the session's frame
+    // duration, the extra slots absorb frames that were already being encoded when it filled up
+    SpscQueue<AudioStreamPacket> audio_send_queue_{MAX_SEND_PACKETS_IN_QUEUE + MAX_SEND_PACKETS_IN_QUEUE / 2};
+    // Audio testing playback, filled and drained by the decode task
+    SpscQueue<AudioStreamPacket> audio_decode_queue_{MAX_AUDIO_PACKETS_IN_QUEUE + MAX_AUDIO_PACKETS_IN_QUEUE / 2};
+    // Incoming audio from the server
+    JitterBuffer jitter_buffer_{MAX_AUDIO_PACKETS_IN_QUEUE};
+    // Sounds waiting to be played, their frames are decoded in place
+    MpscQueue<QueuedSound> sound_queue_{MAX_QUEUED_SOUNDS};
+    std::atomic<uint32_t> sound_generation_ = 0;
+    QueuedSound playing_sound_;
+    size_t playing_sound_offset_ = 0;
+#if CONFIG_USE_SOUND_PCM_CACHE
+    // Cue sounds kept as PCM, filled by the decode task when it starts
+    SoundPcmCache sound_cache_;
+    std::atomic<bool> sound_cache_ready_ = false;
+    std::atomic<int64_t> cue_request_time_ = 0;
+#endif
+    // PCM frames waiting for the encode task, producers are serialized by audio_encode_mutex_
+    SpscQueue<AudioEncodeFrame> audio_encode_queue_{4};
+    std::mutex audio_encode_mutex_;
+    std::atomic<bool> audio_encoder_reset_ = false;
+    // Microphone audio from before the listening started, sent ahead of the live audio
+    PrerollBuffer preroll_{16000, CONFIG_AUDIO_PREROLL_DURATION_MS};
+    std::atomic<bool> preroll_flush_ = false;
+    // Decoded frames waiting for the output task, at most CONFIG_AUDIO_DECODE_AHEAD_FRAMES
+    SpscQueue<AudioPcmFrame> audio_pcm_queue_{CONFIG_AUDIO_DECODE_AHEAD_FRAMES};
+    AudioStreamPacket audio_decode_packet_;
+    AudioPcmFrame audio_decode_frame_;
+    AudioPcmFrame audio_output_frame_;
+    std::vector<int16_t> audio_resample_buffer_;
+    // Matches the playback rate to the server's audio clock, owned by the decode task
+    DriftCompensator drift_compensator_{CONFIG_AUDIO_DRIFT_COMPENSATION_MAX_PPM};
+    std::atomic<bool> audio_decoder_reset_ = false;
+#if CONFIG_USE_LOCAL_BARGE_IN
+    // Set on a barge-in for the output task, which drops what the codec still has queued
+    std::atomic<bool> audio_output_flush_ = false;
+    std::atomic<int64_t> barge_in_time_ = 0;
+    // When the VAD started reporting voice while speaking, 0 if it is not
+    std::atomic<int64_t> barge_in_voice_start_ = 0;
+#endif
+    bool audio_output_playing_ = false;
+    std::atomic<int> playback_drain_state_ = kPlaybackDrainIdle;
+    std::atomic<int64_t> playback_drain_start_ = 0;
+    std::atomic<uint32_t> audio_decoded_frames_ = 0;
+    std::atomic<uint32_t> audio_output_underruns_ = 0;
+    std::atomic<uint32_t> audio_decode_histogram_[AUDIO_DECODE_HISTOGRAM_BUCKETS] = {};
     std::list<AudioStreamPacket> audio_testing_queue_;
+    std::atomic<bool> audio_testing_playback_ = false;
+    std::atomic<uint32_t> audio_send_dropped_newest_ = 0;
+    std::atomic<uint32_t> audio_send_dropped_oldest_ = 0;
+    std::atomic<uint32_t> audio_send_failures_ = 0;
+
+    // Stream position of the server audio being played, stamped on the uplink for server AEC
+    PlaybackClock playback_clock_;
 
-    // 新增：用于维护音频包的timestamp队列
-    std::list<uint32_t> timestamp_queue_;
-    std::mutex timestamp_mutex_;
+    std::unique_ptr<OpusVoiceEncoder> opus_encoder_;
+    std::atomic<int> opus_encoder_frame_duration_ = 0;
+    // Owned by the encode task, the atomics below mirror its operating point for other tasks
+    EncoderRateController encoder_controller_{CONFIG_AUDIO_ENCODE_COMPLEXITY_MIN, CONFIG_AUDIO_ENCODE_COMPLEXITY_MAX,
+        CONFIG_AUDIO_ENCODE_BITRATE_MIN, CONFIG_AUDIO_ENCODE_BITRATE_MAX};
+    std::atomic<int> encoder_complexity_ = 0;
+    std::atomic<int> encoder_bitrate_ = 0;
+    std::atomic<int> encoder_cpu_percent_ = 0;
+#if CONFIG_USE_AUDIO_DTX
+    // Voice state of the audio processor, read by the encode task for silence suppression
+    std::atomic<bool> uplink_voice_ = false;
+    SilenceSuppressor silence_suppressor_{CONFIG_AUDIO_DTX_HANGOVER_MS, CONFIG_AUDIO_DTX_LOOKBACK_MS, AUDIO_PACKET_HEADROOM};
+    uint32_t dtx_encoded_bytes_reported_ = 0;
+#endif
+    std::unique_ptr<OpusFecDecoder> opus_decoder_;
 
-    std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
-    std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
+    // Persistent buffers for ReadAudio and its callers
+    std::vector<int16_t> input_data_;
+    PcmBuffer input_capture_;
+    PcmBuffer input_mic_;
+    PcmBuffer input_reference_;
+    PcmBuffer resampled_mic_;
+    PcmBuffer resampled_reference_;
+    std::atomic<uint32_t> input_buffer_grows_ = 0;
+    uint32_t input_buffer_grows_reported_ = 0;
+    uint32_t audio_bytes_sent_reported_ = 0;
+    uint32_t audio_pool_exhausted_reported_ = 0;
+    uint32_t audio_pool_oversized_reported_ = 0;
+
+#if CONFIG_USE_SPECULATIVE_CHANNEL_OPEN
+    // Audio channel opened on voice activity while idle, before any wake word
+    std::atomic<bool> speculative_channel_ = false;
+    std::atomic<int64_t> speculative_open_time_ = 0;
+    int64_t speculative_closed_time_ = 0;
+    uint32_t speculative_hits_ = 0;
+    uint32_t speculative_wasted_ = 0;
+#endif
 
     OpusResampler input_resampler_;
     OpusResampler reference_resampler_;
     OpusResampler output_resampler_;
 
     void MainEventLoop();
+    void PushMainTask(ScheduledTask&& task);
+    void RunMainTasks();
+    void RunMainTask(ScheduledTask& task);
+    void LogScheduleStats();
     void OnAudioInput();
     void OnAudioOutput();
+    bool DecodeAudio();
+    void PushEncodeQueue(std::vector<int16_t>&& pcm, bool testing);
+    void CreateEncoder(int frame_duration);
+    void AdjustEncoder(const EncoderLoadSample& sample);
+    void AudioEncodeLoop();
+    void AudioDecodeLoop();
+    void AudioOutputLoop();
+    void CheckPlaybackDrained();
+    void OnPlaybackDrained();
     bool ReadAudio(std::vector<int16_t>& data, int sample_rate, int samples);
+    void GrowInputBuffer(PcmBuffer& buffer, size_t samples);
+    bool NextSoundFrame(const uint8_t*& payload, size_t& size, const CachedSound*& cue);
+    void FeedAudioTestingPlayback();
     void ResetDecoder();
     void SetDecodeSampleRate(int sample_rate, int frame_duration);
+#if CONFIG_USE_LOCAL_BARGE_IN
+    void CheckBargeIn();
+#endif
+#if CONFIG_USE_SPECULATIVE_CHANNEL_OPEN
+    void OpenSpeculativeChannel();
+    void CloseSpeculativeChannel();
+    void ClaimSpeculativeChannel(bool wasted);
+#endif
     void CheckNewVersion(Ota& ota);
     void ShowActivationCode(const std::string& code, const std::string& message);
     void OnClockTimer();
     void SetListeningMode(ListeningMode mode);
+    // The listening mode a new turn uses unless the user holds the button
+    ListeningMode GetDefaultListeningMode() const {
+        return aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime;
+    }
+    bool OpenAudioChannel(ListeningMode mode);
     void AudioLoop();
     void EnterAudioTestingMode();
     void ExitAudioTestingMode();
@@ -18,12 +18,48 @@ void AudioCodec::OutputData(std::vector<int16_t>& data) {
     Write(data.data(), data.size());
 }
 
-bool AudioCodec::InputData(std::vector<int16_t>& data) {
-    int samples = Read(data.data(), data.size());
-    if (samples > 0) {
-        return true;
+void AudioCodec::OutputData(const int16_t* data, int samples) {
+    Write(data, samples);
+}
+
+void AudioCodec::FlushOutput() {
+    // The queued audio plays out, codecs that can stop their output channel on its own override this
+}
+
+void AudioCodec::FlushTxChannel() {
+    if (tx_handle_ == nullptr) {
+        return;
+    }
+    // Stopping the channel discards the DMA buffers, silence is preloaded in their place
+    static const uint8_t silence[256] = {};
+    esp_err_t err = i2s_channel_disable(tx_handle_);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to stop the output channel for a flush: %s", esp_err_to_name(err));
+        return;
     }
-    return false;
+    size_t loaded = sizeof(silence);
+    while (loaded == sizeof(silence)) {
+        if (i2s_channel_preload_data(tx_handle_, silence, sizeof(silence), &loaded) != ESP_OK) {
+            break;
+        }
+    }
+    err = i2s_channel_enable(tx_handle_);
+    if (err != ESP_OK) {
+        // Try once more, the output stays silent until the channel runs again
+        ESP_LOGE(TAG, "Failed to restart the output channel after a flush: %s", esp_err_to_name(err));
+        err = i2s_channel_enable(tx_handle_);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Output channel still stopped: %s", esp_err_to_name(err));
+        }
+    }
+}
+
+bool AudioCodec::InputData(std::vector<int16_t>& data) {
+    return InputData(data.data(), data.size());
+}
+
+bool AudioCodec::InputData(int16_t* data, int samples) {
+    return Read(data, samples) > 0;
 }
 
 void AudioCodec::Start() {
@@ -25,7 +25,13 @@ public:
     virtual void EnableOutput(bool enable);
 
     virtual void OutputData(std::vector<int16_t>& data);
+    // Drops the audio still queued for the speaker where the codec can do so without touching the
+    // input, otherwise does nothing. Only call it from the task that writes the output
+    virtual void FlushOutput();
     virtual bool InputData(std::vector<int16_t>& data);
+    // Write from / read into caller-owned storage such as ring buffer slots, without a vector round trip
+    void OutputData(const int16_t* data, int samples);
+    bool InputData(int16_t* data, int samples);
     virtual void Start();
 
     inline bool duplex() const { return duplex_; }
@@ -52,6 +58,9 @@ protected:
     int output_channels_ = 1;
     int output_volume_ = 70;
 
+    // Stops and restarts the output channel, only safe when it does not share a controller with the input
+    void FlushTxChannel();
+
     virtual int Read(int16_t* dest, int samples) = 0;
     virtual int Write(const int16_t* data, int samples) = 0;
 };
@@ -1,7 +1,9 @@
 #include "no_audio_codec.h"
 
 #include <esp_log.h>
-#include <cmath>
+#include <esp_heap_caps.h>
+#include <esp_cpu.h>
+#include <algorithm>
 #include <cstring>
 
 #define TAG "NoAudioCodec"
@@ -13,6 +15,8 @@ NoAudioCodec::~NoAudioCodec() {
     if (tx_handle_ != nullptr) {
         ESP_ERROR_CHECK(i2s_channel_disable(tx_handle_));
     }
+    heap_caps_free(write_buffer_);
+    heap_caps_free(read_buffer_);
 }
 
 NoAudioCodecDuplex::NoAudioCodecDuplex(int input_sample_rate, int output_sample_rate, gpio_num_t bclk, gpio_num_t ws, gpio_num_t dout, gpio_num_t din) {
@@ -335,60 +339,114 @@ NoAudioCodecSimplexPdm::NoAudioCodecSimplexPdm(int input_sample_rate, int output
     ESP_LOGI(TAG, "Simplex channels created");
 }
 
+// Widens 16-bit samples to the 32-bit I2S slot and applies a Q16 gain of at most 65536.
+// |sample * gain| <= 32768 * 65536 fits in an int32_t, so the product never saturates
+static void ScaleToI2s(const int16_t* src, int32_t* dst, int samples, int32_t gain) {
+    int i = 0;
+    for (; i + 4 <= samples; i += 4) {
+        dst[i] = src[i] * gain;
+        dst[i + 1] = src[i + 1] * gain;
+        dst[i + 2] = src[i + 2] * gain;
+        dst[i + 3] = src[i + 3] * gain;
+    }
+    for (; i < samples; i++) {
+        dst[i] = src[i] * gain;
+    }
+}
+
 int NoAudioCodec::Write(const int16_t* data, int samples) {
-    std::vector<int32_t> buffer(samples);
+    if (write_buffer_ == nullptr) {
+        write_buffer_ = (int32_t*)heap_caps_malloc(NO_AUDIO_CODEC_WRITE_CHUNK * sizeof(int32_t), MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+        if (write_buffer_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate the write buffer");
+            return 0;
+        }
+    }
 
     // output_volume_: 0-100
-    // volume_factor_: 0-65536
-    int32_t volume_factor = pow(double(output_volume_) / 100.0, 2) * 65536;
-    for (int i = 0; i < samples; i++) {
-        int64_t temp = int64_t(data[i]) * volume_factor; // 使用 int64_t 进行乘法运算
-        if (temp > INT32_MAX) {
-            buffer[i] = INT32_MAX;
-        } else if (temp < INT32_MIN) {
-            buffer[i] = INT32_MIN;
-        } else {
-            buffer[i] = static_cast<int32_t>(temp);
-        }
+    // volume_gain_: 0-65536
+    if (volume_gain_volume_ != output_volume_) {
+        volume_gain_volume_ = output_volume_;
+        volume_gain_ = output_volume_ * output_volume_ * 65536 / (100 * 100);
     }
 
-    size_t bytes_written;
-    ESP_ERROR_CHECK(i2s_channel_write(tx_handle_, buffer.data(), samples * sizeof(int32_t), &bytes_written, portMAX_DELAY));
-    return bytes_written / sizeof(int32_t);
-}
+    int written = 0;
+#if CONFIG_NO_AUDIO_CODEC_WRITE_STATS_INTERVAL > 0
+    uint32_t cycles = 0;
+#endif
+    while (written < samples) {
+        int chunk = std::min(samples - written, NO_AUDIO_CODEC_WRITE_CHUNK);
+#if CONFIG_NO_AUDIO_CODEC_WRITE_STATS_INTERVAL > 0
+        uint32_t start = esp_cpu_get_cycle_count();
+        ScaleToI2s(data + written, write_buffer_, chunk, volume_gain_);
+        cycles += esp_cpu_get_cycle_count() - start;
+#else
+        ScaleToI2s(data + written, write_buffer_, chunk, volume_gain_);
+#endif
 
-int NoAudioCodec::Read(int16_t* dest, int samples) {
-    size_t bytes_read;
+        size_t bytes_written;
+        ESP_ERROR_CHECK(i2s_channel_write(tx_handle_, write_buffer_, chunk * sizeof(int32_t), &bytes_written, portMAX_DELAY));
+        written += bytes_written / sizeof(int32_t);
+    }
 
-    std::vector<int32_t> bit32_buffer(samples);
-    if (i2s_channel_read(rx_handle_, bit32_buffer.data(), samples * sizeof(int32_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
-        ESP_LOGE(TAG, "Read Failed!");
-        return 0;
+#if CONFIG_NO_AUDIO_CODEC_WRITE_STATS_INTERVAL > 0
+    write_samples_ += samples;
+    write_cycles_ += cycles;
+    write_max_cycles_ = std::max(write_max_cycles_, cycles);
+    if (++write_calls_ == CONFIG_NO_AUDIO_CODEC_WRITE_STATS_INTERVAL) {
+        uint32_t per_1000_samples = write_samples_ > 0 ? (uint64_t)write_cycles_ * 1000 / write_samples_ : 0;
+        ESP_LOGI(TAG, "Output conversion: %lu cycles per write on average (max %lu), %lu cycles per 1000 samples",
+            write_cycles_ / write_calls_, write_max_cycles_, per_1000_samples);
+        write_calls_ = 0;
+        write_samples_ = 0;
+        write_cycles_ = 0;
+        write_max_cycles_ = 0;
     }
+#endif
+    return written;
+}
 
-    samples = bytes_read / sizeof(int32_t);
+// Narrows 32-bit I2S microphone samples, whose top bits carry the data, to 16 bits
+static void I2sToPcm(const int32_t* src, int16_t* dst, int samples) {
     for (int i = 0; i < samples; i++) {
-        int32_t value = bit32_buffer[i] >> 12;
-        dest[i] = (value > INT16_MAX) ? INT16_MAX : (value < -INT16_MAX) ? -INT16_MAX : (int16_t)value;
+        int32_t value = src[i] >> 12;
+        dst[i] = (value > INT16_MAX) ? INT16_MAX : (value < -INT16_MAX) ? -INT16_MAX : (int16_t)value;
+    }
+}
+
+int NoAudioCodec::Read(int16_t* dest, int samples) {
+    if (read_buffer_ == nullptr) {
+        read_buffer_ = (int32_t*)heap_caps_malloc(NO_AUDIO_CODEC_READ_CHUNK * sizeof(int32_t), MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+        if (read_buffer_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate the read buffer");
+            return 0;
+        }
     }
-    return samples;
+
+    int read = 0;
+    while (read < samples) {
+        int chunk = std::min(samples - read, NO_AUDIO_CODEC_READ_CHUNK);
+        size_t bytes_read;
+        if (i2s_channel_read(rx_handle_, read_buffer_, chunk * sizeof(int32_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
+            ESP_LOGE(TAG, "Read Failed!");
+            return 0;
+        }
+        int count = bytes_read / sizeof(int32_t);
+        I2sToPcm(read_buffer_, dest + read, count);
+        read += count;
+    }
+    return read;
 }
 
 int NoAudioCodecSimplexPdm::Read(int16_t* dest, int samples) {
     size_t bytes_read;
 
-    // PDM 解调后的数据位宽为 16 位
-    std::vector<int16_t> bit16_buffer(samples);
-    if (i2s_channel_read(rx_handle_, bit16_buffer.data(), samples * sizeof(int16_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
+    // PDM 解调后的数据位宽为 16 位，直接读入目标缓冲区
+    if (i2s_channel_read(rx_handle_, dest, samples * sizeof(int16_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
         ESP_LOGE(TAG, "Read Failed!");
         return 0;
     }
 
     // 计算实际读取的样本数
-    samples = bytes_read / sizeof(int16_t);
-
-    // 将 16 位数据直接复制到目标缓冲区
-    memcpy(dest, bit16_buffer.data(), samples * sizeof(int16_t));
-
-    return samples;
+    return bytes_read / sizeof(int16_t);
 }
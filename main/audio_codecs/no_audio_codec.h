@@ -6,8 +6,25 @@
 #include <driver/gpio.h>
 #include <driver/i2s_pdm.h>
 
+// Samples converted per i2s_channel_write() / i2s_channel_read() call
+#define NO_AUDIO_CODEC_WRITE_CHUNK (AUDIO_CODEC_DMA_FRAME_NUM * 2)
+#define NO_AUDIO_CODEC_READ_CHUNK (AUDIO_CODEC_DMA_FRAME_NUM * 2)
+
 class NoAudioCodec : public AudioCodec {
 private:
+    // 32-bit I2S samples in internal DMA-capable memory, allocated by the first Write() / Read()
+    int32_t* write_buffer_ = nullptr;
+    int32_t* read_buffer_ = nullptr;
+    // Q16 gain for output_volume_, recomputed when the volume changes
+    int32_t volume_gain_ = 0;
+    int volume_gain_volume_ = -1;
+#if CONFIG_NO_AUDIO_CODEC_WRITE_STATS_INTERVAL > 0
+    uint32_t write_calls_ = 0;
+    uint32_t write_samples_ = 0;
+    uint32_t write_cycles_ = 0;
+    uint32_t write_max_cycles_ = 0;
+#endif
+
     virtual int Write(const int16_t* data, int samples) override;
     virtual int Read(int16_t* dest, int samples) override;
 
@@ -29,12 +46,15 @@ class NoAudioCodecSimplex : public NoAudioCodec {
 public:
     NoAudioCodecSimplex(int input_sample_rate, int output_sample_rate, gpio_num_t spk_bclk, gpio_num_t spk_ws, gpio_num_t spk_dout, gpio_num_t mic_sck, gpio_num_t mic_ws, gpio_num_t mic_din);
     NoAudioCodecSimplex(int input_sample_rate, int output_sample_rate, gpio_num_t spk_bclk, gpio_num_t spk_ws, gpio_num_t spk_dout, i2s_std_slot_mask_t spk_slot_mask, gpio_num_t mic_sck, gpio_num_t mic_ws, gpio_num_t mic_din, i2s_std_slot_mask_t mic_slot_mask);
+    // The speaker has its own I2S controller, stopping it leaves the microphone running
+    virtual void FlushOutput() override { FlushTxChannel(); }
 };
 
 class NoAudioCodecSimplexPdm : public NoAudioCodec {
 public:
     NoAudioCodecSimplexPdm(int input_sample_rate, int output_sample_rate, gpio_num_t spk_bclk, gpio_num_t spk_ws, gpio_num_t spk_dout, gpio_num_t mic_sck,  gpio_num_t mic_din);
     int Read(int16_t* dest, int samples);
+    virtual void FlushOutput() override { FlushTxChannel(); }
 };
 
 #endif // _NO_AUDIO_CODEC_H
@@ -49,7 +49,12 @@ void AfeAudioProcessor::Initialize(AudioCodec* codec) {
 
 #ifdef CONFIG_USE_DEVICE_AEC
     afe_config->aec_init = true;
+#if CONFIG_USE_LOCAL_BARGE_IN || CONFIG_USE_AUDIO_DTX
+    // Barge-in and silence suppression listen for the user over the echo cancelled playback
+    afe_config->vad_init = true;
+#else
     afe_config->vad_init = false;
+#endif
 #else
     afe_config->aec_init = false;
     afe_config->vad_init = true;
@@ -149,7 +154,9 @@ void AfeAudioProcessor::AudioProcessorTask() {
 void AfeAudioProcessor::EnableDeviceAec(bool enable) {
     if (enable) {
 #if CONFIG_USE_DEVICE_AEC
+#if !CONFIG_USE_LOCAL_BARGE_IN && !CONFIG_USE_AUDIO_DTX
         afe_iface_->disable_vad(afe_data_);
+#endif
         afe_iface_->enable_aec(afe_data_);
 #else
         ESP_LOGE(TAG, "Device AEC is not supported");
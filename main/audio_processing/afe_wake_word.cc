@@ -66,6 +66,10 @@ void AfeWakeWord::Initialize(AudioCodec* codec) {
     afe_config->afe_perferred_core = 1;
     afe_config->afe_perferred_priority = 1;
     afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
+#if CONFIG_USE_SPECULATIVE_CHANNEL_OPEN
+    // The application opens the audio channel early when speech is heard
+    afe_config->vad_init = true;
+#endif
     
     afe_iface_ = esp_afe_handle_from_config(afe_config);
     afe_data_ = afe_iface_->create_from_config(afe_config);
@@ -81,12 +85,17 @@ void AfeWakeWord::OnWakeWordDetected(std::function<void(const std::string& wake_
     wake_word_detected_callback_ = callback;
 }
 
+void AfeWakeWord::OnVadStateChange(std::function<void(bool speaking)> callback) {
+    vad_state_change_callback_ = callback;
+}
+
 void AfeWakeWord::StartDetection() {
     xEventGroupSetBits(event_group_, DETECTION_RUNNING_EVENT);
 }
 
 void AfeWakeWord::StopDetection() {
     xEventGroupClearBits(event_group_, DETECTION_RUNNING_EVENT);
+    is_speaking_ = false;
     if (afe_data_ != nullptr) {
         afe_iface_->reset_buffer(afe_data_);
     }
@@ -127,6 +136,16 @@ void AfeWakeWord::AudioDetectionTask() {
         // Store the wake word data for voice recognition, like who is speaking
         StoreWakeWordData(res->data, res->data_size / sizeof(int16_t));
 
+        if (vad_state_change_callback_) {
+            if (res->vad_state == VAD_SPEECH && !is_speaking_) {
+                is_speaking_ = true;
+                vad_state_change_callback_(true);
+            } else if (res->vad_state == VAD_SILENCE && is_speaking_) {
+                is_speaking_ = false;
+                vad_state_change_callback_(false);
+            }
+        }
+
         if (res->wakeup_state == WAKENET_DETECTED) {
             StopDetection();
             last_detected_wake_word_ = wake_words_[res->wake_word_index - 1];
@@ -156,7 +175,7 @@ void AfeWakeWord::EncodeWakeWordData() {
         auto this_ = (AfeWakeWord*)arg;
         {
             auto start_time = esp_timer_get_time();
-            auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+            auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, Application::GetInstance().GetUplinkFrameDuration());
             encoder->SetComplexity(0); // 0 is the fastest
 
             int packets = 0;
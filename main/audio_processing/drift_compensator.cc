@@ -0,0 +1,93 @@
+#include "drift_compensator.h"
+
+#include <algorithm>
+#include <utility>
+
+DriftCompensator::DriftCompensator(int max_ppm) : max_ppm_(max_ppm) {
+}
+
+void DriftCompensator::Reset() {
+    has_window_ = false;
+    has_last_floor_ = false;
+    persist_count_ = 0;
+    persist_sum_ppm_ = 0;
+    phase_ = 0;
+    last_sample_ = 0;
+    adjusted_samples_.store(0, std::memory_order_relaxed);
+}
+
+void DriftCompensator::Update(uint32_t sequence, int64_t arrival_us, int frame_duration_ms) {
+    if (max_ppm_ <= 0) {
+        return;
+    }
+    int64_t transit_us = arrival_us - (int64_t)sequence * frame_duration_ms * 1000;
+    if (!has_window_) {
+        has_window_ = true;
+        window_ms_ = 0;
+        window_floor_us_ = transit_us;
+    }
+    window_floor_us_ = std::min(window_floor_us_, transit_us);
+    window_ms_ += frame_duration_ms;
+    if (window_ms_ < DRIFT_WINDOW_MS) {
+        return;
+    }
+
+    int64_t floor_us = window_floor_us_;
+    has_window_ = false;
+    if (!has_last_floor_) {
+        has_last_floor_ = true;
+        last_floor_us_ = floor_us;
+        return;
+    }
+    // A rising floor means the stream arrives slower than it is played, so play slower
+    int64_t slope_ppm = -(floor_us - last_floor_us_) * 1000 / window_ms_;
+    last_floor_us_ = floor_us;
+    if (slope_ppm > 2 * max_ppm_ || slope_ppm < -2 * max_ppm_) {
+        // The server sent ahead or paused, that says nothing about the clocks
+        persist_count_ = 0;
+        persist_sum_ppm_ = 0;
+        return;
+    }
+    if (persist_count_ > 0 && (slope_ppm < 0) != (persist_sum_ppm_ < 0)) {
+        persist_count_ = 0;
+        persist_sum_ppm_ = 0;
+    }
+    persist_count_++;
+    persist_sum_ppm_ += slope_ppm;
+    if (persist_count_ >= DRIFT_PERSIST_WINDOWS) {
+        int ppm = persist_sum_ppm_ / persist_count_;
+        ppm_.store(std::clamp(ppm, -max_ppm_, max_ppm_), std::memory_order_relaxed);
+    }
+}
+
+void DriftCompensator::Process(std::vector<int16_t>& pcm) {
+    const int n = pcm.size();
+    if (n == 0) {
+        return;
+    }
+    int ppm = ppm_.load(std::memory_order_relaxed);
+    if (ppm == 0) {
+        // Snapping back to whole samples moves the audio by less than a sample
+        phase_ = 0;
+        last_sample_ = pcm.back();
+        return;
+    }
+
+    // Input samples consumed per output sample, Q16
+    const int32_t step = (int32_t)(((int64_t)(1000000 + ppm) << 16) / 1000000);
+    const int32_t end = (n - 1) << 16;
+    buffer_.clear();
+    buffer_.reserve(n + n / 64 + 2);
+    int32_t pos = phase_;
+    while (pos < end) {
+        int index = pos >> 16;
+        int32_t a = index < 0 ? last_sample_ : pcm[index];
+        int32_t b = pcm[index + 1];
+        buffer_.push_back(a + (int32_t)(((int64_t)(b - a) * (pos & 0xFFFF)) >> 16));
+        pos += step;
+    }
+    phase_ = pos - (n << 16);
+    last_sample_ = pcm.back();
+    adjusted_samples_.fetch_add(n - (int)buffer_.size(), std::memory_order_relaxed);
+    std::swap(pcm, buffer_);
+}
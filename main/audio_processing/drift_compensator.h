@@ -0,0 +1,59 @@
+#ifndef DRIFT_COMPENSATOR_H
+#define DRIFT_COMPENSATOR_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Stream time over which the earliest arrival is taken, long enough to see through network jitter
+#define DRIFT_WINDOW_MS 8000
+// Windows in a row whose slope has to agree before the playback rate follows it
+#define DRIFT_PERSIST_WINDOWS 3
+
+/*
+ * Keeps the playback latency constant when the server's audio clock and the local
+ * I2S clock run at slightly different rates. Each packet's transit, its arrival
+ * time minus its position in the stream, is taken at its minimum over a window of
+ * stream time. Drift makes that floor move steadily, by a few ms per minute. Bursts
+ * and pauses of the server move it far faster than any clock drift and are ignored.
+ * Once the slope has kept its sign for DRIFT_PERSIST_WINDOWS windows, the decoded
+ * audio is stretched or shrunk by it, up to max_ppm, with linear interpolation.
+ *
+ * All methods except ppm() and adjusted_samples() belong to the decode task.
+ */
+class DriftCompensator {
+public:
+    DriftCompensator(int max_ppm);
+
+    // Starts a new stream. The rate found so far is kept, it belongs to the clocks, not the stream
+    void Reset();
+    // A packet of the stream arrived at arrival_us, the local time
+    void Update(uint32_t sequence, int64_t arrival_us, int frame_duration_ms);
+    // Resamples pcm at the current rate, the phase carries over to the next frame
+    void Process(std::vector<int16_t>& pcm);
+
+    // Positive while playing faster than the stream, to drain a growing buffer
+    int ppm() const { return ppm_.load(std::memory_order_relaxed); }
+    // Samples dropped (positive) or inserted (negative) since the last reset
+    int32_t adjusted_samples() const { return adjusted_samples_.load(std::memory_order_relaxed); }
+
+private:
+    const int max_ppm_;
+    bool has_window_ = false;
+    int window_ms_ = 0;
+    int64_t window_floor_us_ = 0;
+    bool has_last_floor_ = false;
+    int64_t last_floor_us_ = 0;
+    // Windows in a row whose slope had the same sign, and their summed slope
+    int persist_count_ = 0;
+    int64_t persist_sum_ppm_ = 0;
+    // Position of the next output sample relative to the first input sample, in 1/65536
+    // samples. It is negative while the output still falls between the frames
+    int32_t phase_ = 0;
+    int16_t last_sample_ = 0;
+    std::vector<int16_t> buffer_;
+    std::atomic<int> ppm_{0};
+    std::atomic<int32_t> adjusted_samples_{0};
+};
+
+#endif // DRIFT_COMPENSATOR_H
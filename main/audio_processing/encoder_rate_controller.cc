@@ -0,0 +1,56 @@
+#include "encoder_rate_controller.h"
+
+#include <algorithm>
+
+EncoderRateController::EncoderRateController(int min_complexity, int max_complexity, int min_bitrate, int max_bitrate)
+    : min_complexity_(min_complexity), max_complexity_(std::max(min_complexity, max_complexity)),
+      min_bitrate_(min_bitrate), max_bitrate_(std::max(min_bitrate, max_bitrate)) {
+    Reset(max_complexity_, max_bitrate_);
+}
+
+void EncoderRateController::Reset(int complexity, int bitrate) {
+    complexity_ = std::clamp(complexity, min_complexity_, max_complexity_);
+    bitrate_ = std::clamp(bitrate, min_bitrate_, max_bitrate_);
+    cpu_idle_windows_ = 0;
+    network_clean_windows_ = 0;
+}
+
+bool EncoderRateController::Update(const EncoderLoadSample& sample) {
+    if (sample.frames == 0 || sample.frame_duration_ms <= 0) {
+        return false;
+    }
+    int complexity = complexity_;
+    int bitrate = bitrate_;
+
+    uint64_t real_time_us = (uint64_t)sample.frames * sample.frame_duration_ms * 1000;
+    cpu_percent_ = (int)((uint64_t)sample.encode_us * 100 / real_time_us);
+    if (cpu_percent_ > ENCODER_CPU_HIGH_PERCENT) {
+        complexity -= 2;
+        cpu_idle_windows_ = 0;
+    } else if (cpu_percent_ < ENCODER_CPU_LOW_PERCENT) {
+        if (++cpu_idle_windows_ >= ENCODER_COMPLEXITY_UP_WINDOWS) {
+            complexity++;
+            cpu_idle_windows_ = 0;
+        }
+    } else {
+        cpu_idle_windows_ = 0;
+    }
+
+    bool congested = sample.drops > 0 || sample.send_failures > 0 || sample.queue_depth * 2 > sample.queue_limit;
+    if (congested) {
+        bitrate = bitrate * 3 / 4;
+        network_clean_windows_ = 0;
+    } else if (++network_clean_windows_ >= ENCODER_BITRATE_UP_WINDOWS) {
+        bitrate += ENCODER_BITRATE_STEP;
+        network_clean_windows_ = 0;
+    }
+
+    complexity = std::clamp(complexity, min_complexity_, max_complexity_);
+    bitrate = std::clamp(bitrate, min_bitrate_, max_bitrate_);
+    if (complexity == complexity_ && bitrate == bitrate_) {
+        return false;
+    }
+    complexity_ = complexity;
+    bitrate_ = bitrate;
+    return true;
+}
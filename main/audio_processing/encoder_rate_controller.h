@@ -0,0 +1,55 @@
+#ifndef ENCODER_RATE_CONTROLLER_H
+#define ENCODER_RATE_CONTROLLER_H
+
+#include <cstdint>
+
+// Encoding is too slow above this share of real time, and has room to spare below the low mark
+#define ENCODER_CPU_HIGH_PERCENT 50
+#define ENCODER_CPU_LOW_PERCENT 20
+// Windows without a problem before the complexity or the bitrate goes up again
+#define ENCODER_COMPLEXITY_UP_WINDOWS 5
+#define ENCODER_BITRATE_UP_WINDOWS 3
+#define ENCODER_BITRATE_STEP 2000
+
+// What the uplink went through during one control window
+struct EncoderLoadSample {
+    uint32_t frames;            // Frames encoded
+    uint32_t encode_us;         // CPU time spent encoding them
+    int frame_duration_ms;
+    int queue_depth;            // Send queue depth at the end of the window
+    int queue_limit;            // Depth at which the oldest packets are dropped
+    uint32_t drops;             // Packets dropped because the send queue was full
+    uint32_t send_failures;
+};
+
+/*
+ * Picks the Opus complexity from the encoder CPU time and the bitrate from the
+ * state of the send queue: multiplicative decrease when packets back up, are
+ * dropped or fail to send, additive increase after a few clean windows.
+ */
+class EncoderRateController {
+public:
+    EncoderRateController(int min_complexity, int max_complexity, int min_bitrate, int max_bitrate);
+
+    void Reset(int complexity, int bitrate);
+    // Returns true if the operating point changed
+    bool Update(const EncoderLoadSample& sample);
+
+    int complexity() const { return complexity_; }
+    int bitrate() const { return bitrate_; }
+    // Encoder CPU time in the last window, in percent of real time
+    int cpu_percent() const { return cpu_percent_; }
+
+private:
+    int min_complexity_;
+    int max_complexity_;
+    int min_bitrate_;
+    int max_bitrate_;
+    int complexity_;
+    int bitrate_;
+    int cpu_percent_ = 0;
+    int cpu_idle_windows_ = 0;
+    int network_clean_windows_ = 0;
+};
+
+#endif // ENCODER_RATE_CONTROLLER_H
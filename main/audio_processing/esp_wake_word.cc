@@ -50,6 +50,10 @@ void EspWakeWord::OnWakeWordDetected(std::function<void(const std::string& wake_
     wake_word_detected_callback_ = callback;
 }
 
+void EspWakeWord::OnVadStateChange(std::function<void(bool speaking)> callback) {
+    // WakeNet alone has no voice activity detection
+}
+
 void EspWakeWord::StartDetection() {
     xEventGroupSetBits(event_group_, DETECTION_RUNNING_EVENT);
 }
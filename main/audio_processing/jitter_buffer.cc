@@ -0,0 +1,199 @@
+#include "jitter_buffer.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <cmath>
+
+#define TAG "JitterBuffer"
+
+JitterBuffer::JitterBuffer(int capacity) {
+    // A power of two keeps the slot index continuous when the 32-bit sequence wraps
+    int size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    slots_.resize(size);
+    present_.resize(size, false);
+    mask_ = size - 1;
+}
+
+void JitterBuffer::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::fill(present_.begin(), present_.end(), false);
+    count_ = 0;
+    started_ = false;
+    buffering_ = true;
+    starved_ = false;
+    end_of_stream_ = false;
+    has_transit_ = false;
+}
+
+void JitterBuffer::MarkEndOfStream() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    end_of_stream_ = true;
+}
+
+void JitterBuffer::UpdateJitter(uint32_t sequence, int64_t now_ms) {
+    // Playout consumes one frame per frame duration, so measure each arrival against that clock.
+    // Servers send TTS faster than real time, which only lowers the transit, so jitter is the delay
+    // above the earliest transit seen in this stream rather than the change between packets
+    int64_t transit = now_ms - (int64_t)sequence * frame_duration_;
+    if (!has_transit_ || transit < min_transit_ms_) {
+        min_transit_ms_ = transit;
+        has_transit_ = true;
+    }
+    float delay = (float)(transit - min_transit_ms_);
+    jitter_ms_ += (delay - jitter_ms_) / 16.0f;
+
+    int depth = (int)std::ceil(2.0f * jitter_ms_ / frame_duration_) + 1;
+    int max_depth = std::max(JITTER_BUFFER_MIN_DEPTH, JITTER_BUFFER_MAX_DEPTH_MS / frame_duration_);
+    target_depth_ = std::clamp(depth, JITTER_BUFFER_MIN_DEPTH, std::min(max_depth, (int)slots_.size()));
+}
+
+bool JitterBuffer::Put(AudioStreamPacket&& packet) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    packet.arrival_time = esp_timer_get_time();
+    int64_t now_ms = packet.arrival_time / 1000;
+    const int capacity = slots_.size();
+    uint32_t sequence = packet.sequence;
+
+    if (packet.frame_duration > 0) {
+        frame_duration_ = packet.frame_duration;
+    }
+    sample_rate_ = packet.sample_rate;
+
+    if (!started_) {
+        started_ = true;
+        next_sequence_ = sequence;
+        highest_sequence_ = sequence;
+        buffering_ = true;
+    }
+    if (end_of_stream_ && count_ == 0) {
+        // A new stream starts, measure it against its own transit
+        end_of_stream_ = false;
+        has_transit_ = false;
+    }
+
+    UpdateJitter(sequence, now_ms);
+
+    int32_t offset = (int32_t)(sequence - next_sequence_);
+    if (offset < 0) {
+        late_++;
+        return false;
+    }
+    if (offset >= capacity) {
+        if (count_ > 0) {
+            overflows_++;
+            return false;
+        }
+        // Nothing buffered, resynchronize to the new sequence
+        ESP_LOGW(TAG, "Sequence jumped from %lu to %lu", next_sequence_, sequence);
+        next_sequence_ = sequence;
+    }
+
+    int index = sequence & mask_;
+    if (present_[index]) {
+        duplicates_++;
+        return false;
+    }
+    if ((int32_t)(sequence - highest_sequence_) < 0) {
+        reordered_++;
+    } else {
+        highest_sequence_ = sequence;
+    }
+    if (starved_) {
+        starved_ = false;
+        underruns_++;
+    }
+    if (buffering_ && count_ == 0) {
+        buffering_since_ms_ = now_ms;
+    }
+
+    std::swap(slots_[index], packet);
+    present_[index] = true;
+    count_++;
+    return true;
+}
+
+int JitterBuffer::FindNextPresent() const {
+    const int capacity = slots_.size();
+    for (int i = 0; i < capacity; i++) {
+        if (present_[(next_sequence_ + i) & mask_]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+JitterBufferResult JitterBuffer::Get(AudioStreamPacket& packet) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now_ms = esp_timer_get_time() / 1000;
+
+    if (count_ == 0) {
+        if (!buffering_) {
+            buffering_ = true;
+            // Running dry after the last packet of a stream is not an underrun
+            starved_ = !end_of_stream_;
+        }
+        return kJitterBufferEmpty;
+    }
+
+    if (buffering_) {
+        // Start playout once the target depth is reached, or the first packet has waited long enough
+        if (count_ < target_depth_ && now_ms - buffering_since_ms_ < target_depth_ * frame_duration_) {
+            return kJitterBufferEmpty;
+        }
+        buffering_ = false;
+    }
+
+    int index = next_sequence_ & mask_;
+    if (!present_[index]) {
+        int distance = FindNextPresent();
+        if (distance > JITTER_BUFFER_MAX_LOST_RUN) {
+            lost_ += distance;
+            next_sequence_ += distance;
+            index = next_sequence_ & mask_;
+        } else {
+            lost_++;
+            packet.sequence = next_sequence_++;
+            packet.sample_rate = sample_rate_;
+            packet.frame_duration = frame_duration_;
+            packet.arrival_time = 0;
+            // Hand out a copy of the following packet so the caller can decode its FEC data
+            int next_index = next_sequence_ & mask_;
+            if (present_[next_index]) {
+                packet.payload = slots_[next_index].payload;
+            } else {
+                packet.payload.clear();
+            }
+            return kJitterBufferLost;
+        }
+    }
+
+    std::swap(packet, slots_[index]);
+    present_[index] = false;
+    count_--;
+    next_sequence_++;
+    return kJitterBufferPacket;
+}
+
+int JitterBuffer::Size() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return count_;
+}
+
+JitterBufferStats JitterBuffer::GetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return JitterBufferStats{
+        .depth = count_,
+        .target_depth = target_depth_,
+        .jitter_ms = (int)jitter_ms_,
+        .late = late_,
+        .lost = lost_,
+        .reordered = reordered_,
+        .duplicates = duplicates_,
+        .overflows = overflows_,
+        .underruns = underruns_,
+    };
+}
@@ -0,0 +1,90 @@
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "protocol.h"
+
+#define JITTER_BUFFER_MIN_DEPTH 1
+// The most audio held back before playout, the packet count follows the frame duration
+#define JITTER_BUFFER_MAX_DEPTH_MS 360
+// Gaps longer than this are skipped instead of being reported frame by frame
+#define JITTER_BUFFER_MAX_LOST_RUN 3
+
+struct JitterBufferStats {
+    int depth;              // Packets currently buffered
+    int target_depth;       // Packets buffered before playout starts
+    int jitter_ms;          // Smoothed arrival delay against the playout clock
+    uint32_t late;          // Arrived after their playout time
+    uint32_t lost;          // Never arrived in time
+    uint32_t reordered;     // Arrived out of order but in time
+    uint32_t duplicates;
+    uint32_t overflows;     // Dropped because the buffer was full
+    uint32_t underruns;     // Ran dry in the middle of a stream
+};
+
+enum JitterBufferResult {
+    kJitterBufferEmpty,     // Nothing to play yet
+    kJitterBufferPacket,    // A packet was returned
+    kJitterBufferLost,      // The next packet is missing, the caller should conceal it. The payload
+                            // is a copy of the packet after it if that one has arrived, or empty
+};
+
+/*
+ * Reorders incoming audio packets by sequence number and holds back playout until
+ * target_depth packets are buffered. The target depth follows how late packets arrive
+ * against a one frame per frame duration playout clock, bounded by
+ * JITTER_BUFFER_MIN_DEPTH packets and JITTER_BUFFER_MAX_DEPTH_MS.
+ *
+ * Put() is called from the network task and Get() from the audio task.
+ */
+class JitterBuffer {
+public:
+    // The capacity is rounded up to a power of two
+    JitterBuffer(int capacity);
+
+    void Reset();
+    // The server has sent the last packet of a stream, so running dry is not an underrun
+    void MarkEndOfStream();
+    bool Put(AudioStreamPacket&& packet);
+    JitterBufferResult Get(AudioStreamPacket& packet);
+    JitterBufferStats GetStats();
+    int Size();
+    // Packets the buffer can hold, each keeps its payload buffer until the slot is reused
+    int capacity() const { return slots_.size(); }
+
+private:
+    std::mutex mutex_;
+    std::vector<AudioStreamPacket> slots_;
+    std::vector<bool> present_;
+    uint32_t mask_ = 0;
+    int count_ = 0;
+    bool started_ = false;
+    bool buffering_ = true;
+    bool starved_ = false;
+    bool end_of_stream_ = false;
+    int64_t buffering_since_ms_ = 0;
+    uint32_t next_sequence_ = 0;
+    uint32_t highest_sequence_ = 0;
+    int sample_rate_ = 0;
+    int frame_duration_ = 60;
+
+    bool has_transit_ = false;
+    int64_t min_transit_ms_ = 0;
+    float jitter_ms_ = 0;
+    int target_depth_ = JITTER_BUFFER_MIN_DEPTH;
+
+    uint32_t late_ = 0;
+    uint32_t lost_ = 0;
+    uint32_t reordered_ = 0;
+    uint32_t duplicates_ = 0;
+    uint32_t overflows_ = 0;
+    uint32_t underruns_ = 0;
+
+    void UpdateJitter(uint32_t sequence, int64_t now_ms);
+    int FindNextPresent() const;
+};
+
+#endif // JITTER_BUFFER_H
@@ -15,6 +15,10 @@ void NoWakeWord::OnWakeWordDetected(std::function<void(const std::string& wake_w
     // Do nothing - no wake word processing
 }
 
+void NoWakeWord::OnVadStateChange(std::function<void(bool speaking)> callback) {
+    // Do nothing - no wake word processing
+}
+
 void NoWakeWord::StartDetection() {
     // Do nothing - no wake word processing
 }
@@ -16,6 +16,7 @@ public:
     void Initialize(AudioCodec* codec) override;
     void Feed(const std::vector<int16_t>& data) override;
     void OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) override;
+    void OnVadStateChange(std::function<void(bool speaking)> callback) override;
     void StartDetection() override;
     void StopDetection() override;
     bool IsDetectionRunning() override;
@@ -0,0 +1,94 @@
+#include "opus_fec_decoder.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "OpusFecDecoder"
+
+OpusFecDecoder::OpusFecDecoder(int sample_rate, int channels, int duration_ms)
+    : sample_rate_(sample_rate), channels_(channels), duration_ms_(duration_ms) {
+    int error;
+    audio_dec_ = opus_decoder_create(sample_rate, channels, &error);
+    if (audio_dec_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create audio decoder, error code: %d", error);
+        return;
+    }
+    frame_size_ = sample_rate / 1000 * channels * duration_ms;
+}
+
+OpusFecDecoder::~OpusFecDecoder() {
+    if (audio_dec_ != nullptr) {
+        opus_decoder_destroy(audio_dec_);
+    }
+}
+
+// Whether the first frame of the packet carries SILK LBRR data, the FEC data for the packet before it.
+// The same check as opus_packet_has_lbrr(), which older libopus releases do not have
+static bool HasLbrr(const uint8_t* packet, size_t size) {
+    if (size == 0 || (packet[0] & 0x80) != 0) {
+        // Empty or CELT only, which has no FEC data
+        return false;
+    }
+    const unsigned char* frames[48];
+    opus_int16 frame_sizes[48];
+    if (opus_packet_parse(packet, size, nullptr, frames, frame_sizes, nullptr) <= 0 || frame_sizes[0] == 0) {
+        return false;
+    }
+    // The range coded SILK header starts with one VAD bit per 20 ms SILK frame, then the LBRR bit
+    int silk_frames = std::max(1, opus_packet_get_samples_per_frame(packet, 48000) / 960);
+    bool lbrr = (frames[0][0] >> (7 - silk_frames)) & 0x1;
+    if (opus_packet_get_nb_channels(packet) == 2) {
+        lbrr = lbrr || ((frames[0][0] >> (6 - 2 * silk_frames)) & 0x1);
+    }
+    return lbrr;
+}
+
+bool OpusFecDecoder::Decode(const std::vector<uint8_t>& opus, std::vector<int16_t>& pcm) {
+    return Decode(opus.data(), opus.size(), pcm);
+}
+
+bool OpusFecDecoder::Decode(const uint8_t* opus, size_t size, std::vector<int16_t>& pcm) {
+    if (audio_dec_ == nullptr) {
+        return false;
+    }
+
+    pcm.resize(frame_size_);
+    auto ret = opus_decode(audio_dec_, opus, size, pcm.data(), pcm.size() / channels_, 0);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to decode audio, error code: %d", ret);
+        return false;
+    }
+    pcm.resize(ret * channels_);
+    return true;
+}
+
+bool OpusFecDecoder::DecodeLost(const std::vector<uint8_t>& next, std::vector<int16_t>& pcm) {
+    if (audio_dec_ == nullptr) {
+        return false;
+    }
+
+    // The frame size must match the lost frame exactly when decoding FEC data.
+    // Without FEC data in the next packet libopus would fall back to PLC by itself,
+    // so it is checked first to count what the frame was actually rebuilt from.
+    pcm.resize(frame_size_);
+    int ret;
+    if (HasLbrr(next.data(), next.size())) {
+        ret = opus_decode(audio_dec_, next.data(), next.size(), pcm.data(), frame_size_ / channels_, 1);
+        fec_frames_++;
+    } else {
+        ret = opus_decode(audio_dec_, nullptr, 0, pcm.data(), frame_size_ / channels_, 0);
+        plc_frames_++;
+    }
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to conceal lost audio, error code: %d", ret);
+        return false;
+    }
+    pcm.resize(ret * channels_);
+    return true;
+}
+
+void OpusFecDecoder::ResetState() {
+    if (audio_dec_ != nullptr) {
+        opus_decoder_ctl(audio_dec_, OPUS_RESET_STATE);
+    }
+}
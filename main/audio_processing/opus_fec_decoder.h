@@ -0,0 +1,42 @@
+#ifndef OPUS_FEC_DECODER_H
+#define OPUS_FEC_DECODER_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include <opus.h>
+
+/*
+ * Opus decoder that can conceal lost packets. A lost frame is rebuilt from the
+ * in-band FEC data of the following packet when the sender included it, and
+ * from the decoder's packet loss concealment otherwise.
+ */
+class OpusFecDecoder {
+public:
+    OpusFecDecoder(int sample_rate, int channels, int duration_ms = 60);
+    ~OpusFecDecoder();
+
+    bool Decode(const std::vector<uint8_t>& opus, std::vector<int16_t>& pcm);
+    bool Decode(const uint8_t* opus, size_t size, std::vector<int16_t>& pcm);
+    // next is the packet after the lost one, or empty if it has not arrived
+    bool DecodeLost(const std::vector<uint8_t>& next, std::vector<int16_t>& pcm);
+    void ResetState();
+
+    int sample_rate() const { return sample_rate_; }
+    int duration_ms() const { return duration_ms_; }
+    // Lost frames rebuilt from the FEC data of the next packet, and those concealed without it
+    uint32_t fec_frames() const { return fec_frames_; }
+    uint32_t plc_frames() const { return plc_frames_; }
+
+private:
+    OpusDecoder* audio_dec_ = nullptr;
+    int sample_rate_;
+    int channels_;
+    int duration_ms_;
+    int frame_size_;
+    uint32_t fec_frames_ = 0;
+    uint32_t plc_frames_ = 0;
+};
+
+#endif // OPUS_FEC_DECODER_H
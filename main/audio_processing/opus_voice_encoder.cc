@@ -0,0 +1,67 @@
+#include "opus_voice_encoder.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "OpusVoiceEncoder"
+
+// The largest packet a voice frame can take at the highest bitrate used here
+#define MAX_OPUS_PACKET_SIZE 1000
+
+OpusVoiceEncoder::OpusVoiceEncoder(int sample_rate, int channels, int duration_ms, size_t headroom)
+    : sample_rate_(sample_rate), channels_(channels), duration_ms_(duration_ms), headroom_(headroom) {
+    int error;
+    audio_enc_ = opus_encoder_create(sample_rate, channels, OPUS_APPLICATION_VOIP, &error);
+    if (audio_enc_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create audio encoder, error code: %d", error);
+        return;
+    }
+    frame_size_ = sample_rate / 1000 * channels * duration_ms;
+    encode_buffer_.resize(MAX_OPUS_PACKET_SIZE);
+    SetDtx(true);
+    opus_encoder_ctl(audio_enc_, OPUS_GET_BITRATE(&bitrate_));
+    opus_encoder_ctl(audio_enc_, OPUS_GET_COMPLEXITY(&complexity_));
+}
+
+OpusVoiceEncoder::~OpusVoiceEncoder() {
+    if (audio_enc_ != nullptr) {
+        opus_encoder_destroy(audio_enc_);
+    }
+}
+
+bool OpusVoiceEncoder::EncodeFrame(const int16_t* pcm) {
+    auto ret = opus_encode(audio_enc_, pcm, frame_size_ / channels_, encode_buffer_.data(), encode_buffer_.size());
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to encode audio, error code: %d", ret);
+        return false;
+    }
+    // Only allocates while the buffers coming back from the handler are new
+    packet_.resize(headroom_ + ret);
+    std::copy(encode_buffer_.begin(), encode_buffer_.begin() + ret, packet_.begin() + headroom_);
+    return true;
+}
+
+void OpusVoiceEncoder::ResetState() {
+    if (audio_enc_ != nullptr) {
+        opus_encoder_ctl(audio_enc_, OPUS_RESET_STATE);
+    }
+    in_buffer_.clear();
+}
+
+void OpusVoiceEncoder::SetComplexity(int complexity) {
+    if (audio_enc_ != nullptr && opus_encoder_ctl(audio_enc_, OPUS_SET_COMPLEXITY(complexity)) == OPUS_OK) {
+        complexity_ = complexity;
+    }
+}
+
+void OpusVoiceEncoder::SetBitrate(int bitrate) {
+    if (audio_enc_ != nullptr && opus_encoder_ctl(audio_enc_, OPUS_SET_BITRATE(bitrate)) == OPUS_OK) {
+        bitrate_ = bitrate;
+    }
+}
+
+void OpusVoiceEncoder::SetDtx(bool enable) {
+    if (audio_enc_ != nullptr) {
+        opus_encoder_ctl(audio_enc_, OPUS_SET_DTX(enable ? 1 : 0));
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef OPUS_VOICE_ENCODER_H
+#define OPUS_VOICE_ENCODER_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include <opus.h>
+
+/*
+ * Opus encoder for the uplink voice stream. Unlike OpusEncoderWrapper it lets
+ * the complexity and the bitrate be changed between frames, so they can follow
+ * the CPU and network load, and discontinuous transmission to be switched
+ * off. Like OpusEncoderWrapper it starts with DTX on.
+ *
+ * The handler gets each packet in a buffer owned by the encoder, and takes it
+ * by swapping it with a buffer it is done with, which the next packet reuses.
+ */
+class OpusVoiceEncoder {
+public:
+    // Each packet starts with headroom unused bytes, for the transport to put its header in
+    OpusVoiceEncoder(int sample_rate, int channels, int duration_ms = 60, size_t headroom = 0);
+    ~OpusVoiceEncoder();
+    OpusVoiceEncoder(const OpusVoiceEncoder&) = delete;
+    OpusVoiceEncoder& operator=(const OpusVoiceEncoder&) = delete;
+
+    // Buffers the samples and calls handler(std::vector<uint8_t>& opus) once per complete frame.
+    // The handler is a template parameter, so passing a lambda does not build a std::function per call
+    template <typename Handler>
+    void Encode(std::vector<int16_t>&& pcm, Handler&& handler) {
+        if (audio_enc_ == nullptr) {
+            return;
+        }
+        in_buffer_.insert(in_buffer_.end(), pcm.begin(), pcm.end());
+        size_t offset = 0;
+        while (in_buffer_.size() - offset >= (size_t)frame_size_) {
+            bool encoded = EncodeFrame(in_buffer_.data() + offset);
+            offset += frame_size_;
+            if (encoded) {
+                handler(packet_);
+            }
+        }
+        in_buffer_.erase(in_buffer_.begin(), in_buffer_.begin() + offset);
+    }
+    void ResetState();
+    void SetComplexity(int complexity);
+    void SetBitrate(int bitrate);
+    // With DTX, silent frames come out as packets of at most two bytes
+    void SetDtx(bool enable);
+
+    int sample_rate() const { return sample_rate_; }
+    int duration_ms() const { return duration_ms_; }
+    size_t headroom() const { return headroom_; }
+    int complexity() const { return complexity_; }
+    int bitrate() const { return bitrate_; }
+
+private:
+    OpusEncoder* audio_enc_ = nullptr;
+    int sample_rate_;
+    int channels_;
+    int duration_ms_;
+    int frame_size_;
+    size_t headroom_;
+    opus_int32 complexity_ = 0;
+    opus_int32 bitrate_ = 0;
+    std::vector<int16_t> in_buffer_;
+    // Room for the largest packet, the handler gets a copy of the encoded size
+    std::vector<uint8_t> encode_buffer_;
+    std::vector<uint8_t> packet_;
+
+    // Encodes one frame into packet_
+    bool EncodeFrame(const int16_t* pcm);
+};
+
+#endif // OPUS_VOICE_ENCODER_H
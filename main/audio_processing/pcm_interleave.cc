@@ -0,0 +1,104 @@
+#include "pcm_interleave.h"
+#include "sdkconfig.h"
+
+#include <cstring>
+
+static inline bool IsAligned(const void* a, const void* b, const void* c, uintptr_t alignment) {
+    return (((uintptr_t)a | (uintptr_t)b | (uintptr_t)c) & (alignment - 1)) == 0;
+}
+
+#if CONFIG_IDF_TARGET_ESP32S3
+// 8 frames per iteration, all pointers must be 16-byte aligned
+static size_t DeinterleavePie(const int16_t* src, int16_t* ch0, int16_t* ch1, size_t frames) {
+    size_t blocks = frames / 8;
+    for (size_t i = 0; i < blocks; i++) {
+        asm volatile(
+            "ee.vld.128.ip q0, %0, 16\n"
+            "ee.vld.128.ip q1, %0, 16\n"
+            "ee.vunzip.16 q0, q1\n"
+            "ee.vst.128.ip q0, %1, 16\n"
+            "ee.vst.128.ip q1, %2, 16\n"
+            : "+r"(src), "+r"(ch0), "+r"(ch1)
+            :
+            : "memory");
+    }
+    return blocks * 8;
+}
+
+static size_t InterleavePie(const int16_t* ch0, const int16_t* ch1, int16_t* dst, size_t frames) {
+    size_t blocks = frames / 8;
+    for (size_t i = 0; i < blocks; i++) {
+        asm volatile(
+            "ee.vld.128.ip q0, %0, 16\n"
+            "ee.vld.128.ip q1, %1, 16\n"
+            "ee.vzip.16 q0, q1\n"
+            "ee.vst.128.ip q0, %2, 16\n"
+            "ee.vst.128.ip q1, %2, 16\n"
+            : "+r"(ch0), "+r"(ch1), "+r"(dst)
+            :
+            : "memory");
+    }
+    return blocks * 8;
+}
+#endif
+
+// 2 frames per iteration, all pointers must be 4-byte aligned
+static size_t DeinterleaveWords(const int16_t* src, int16_t* ch0, int16_t* ch1, size_t frames) {
+    size_t pairs = frames / 2;
+    for (size_t i = 0; i < pairs; i++) {
+        uint32_t x, y;
+        memcpy(&x, src + i * 4, 4);
+        memcpy(&y, src + i * 4 + 2, 4);
+        uint32_t a = (x & 0xFFFF) | (y << 16);
+        uint32_t b = (x >> 16) | (y & 0xFFFF0000);
+        memcpy(ch0 + i * 2, &a, 4);
+        memcpy(ch1 + i * 2, &b, 4);
+    }
+    return pairs * 2;
+}
+
+static size_t InterleaveWords(const int16_t* ch0, const int16_t* ch1, int16_t* dst, size_t frames) {
+    size_t pairs = frames / 2;
+    for (size_t i = 0; i < pairs; i++) {
+        uint32_t a, b;
+        memcpy(&a, ch0 + i * 2, 4);
+        memcpy(&b, ch1 + i * 2, 4);
+        uint32_t x = (a & 0xFFFF) | (b << 16);
+        uint32_t y = (a >> 16) | (b & 0xFFFF0000);
+        memcpy(dst + i * 4, &x, 4);
+        memcpy(dst + i * 4 + 2, &y, 4);
+    }
+    return pairs * 2;
+}
+
+void PcmDeinterleave(const int16_t* src, int16_t* ch0, int16_t* ch1, size_t frames) {
+    size_t done = 0;
+#if CONFIG_IDF_TARGET_ESP32S3
+    if (IsAligned(src, ch0, ch1, PCM_BUFFER_ALIGNMENT)) {
+        done = DeinterleavePie(src, ch0, ch1, frames);
+    }
+#endif
+    if (IsAligned(src + done * 2, ch0 + done, ch1 + done, 4)) {
+        done += DeinterleaveWords(src + done * 2, ch0 + done, ch1 + done, frames - done);
+    }
+    for (size_t i = done; i < frames; i++) {
+        ch0[i] = src[i * 2];
+        ch1[i] = src[i * 2 + 1];
+    }
+}
+
+void PcmInterleave(const int16_t* ch0, const int16_t* ch1, int16_t* dst, size_t frames) {
+    size_t done = 0;
+#if CONFIG_IDF_TARGET_ESP32S3
+    if (IsAligned(ch0, ch1, dst, PCM_BUFFER_ALIGNMENT)) {
+        done = InterleavePie(ch0, ch1, dst, frames);
+    }
+#endif
+    if (IsAligned(ch0 + done, ch1 + done, dst + done * 2, 4)) {
+        done += InterleaveWords(ch0 + done, ch1 + done, dst + done * 2, frames - done);
+    }
+    for (size_t i = done; i < frames; i++) {
+        dst[i * 2] = ch0[i];
+        dst[i * 2 + 1] = ch1[i];
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef PCM_INTERLEAVE_H
+#define PCM_INTERLEAVE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+#include <esp_heap_caps.h>
+
+// Alignment needed by the ESP32-S3 PIE 128-bit loads and stores
+#define PCM_BUFFER_ALIGNMENT 16
+
+template <typename T>
+struct PcmBufferAllocator {
+    using value_type = T;
+
+    PcmBufferAllocator() = default;
+    template <typename U>
+    PcmBufferAllocator(const PcmBufferAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        void* p = heap_caps_aligned_alloc(PCM_BUFFER_ALIGNMENT, n * sizeof(T), MALLOC_CAP_DEFAULT);
+        if (p == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, size_t) { heap_caps_free(p); }
+
+    template <typename U>
+    bool operator==(const PcmBufferAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const PcmBufferAllocator<U>&) const { return false; }
+};
+
+// Scratch buffer whose storage can be used by the SIMD kernels below
+using PcmBuffer = std::vector<int16_t, PcmBufferAllocator<int16_t>>;
+
+/*
+ * Split interleaved stereo samples into two channels, and the reverse.
+ * On the ESP32-S3 the bulk of the work is done 8 frames at a time with PIE
+ * instructions when all pointers are PCM_BUFFER_ALIGNMENT aligned. Other
+ * targets and unaligned buffers move two frames per 32-bit word.
+ */
+void PcmDeinterleave(const int16_t* src, int16_t* ch0, int16_t* ch1, size_t frames);
+void PcmInterleave(const int16_t* ch0, const int16_t* ch1, int16_t* dst, size_t frames);
+
+#endif // PCM_INTERLEAVE_H
@@ -0,0 +1,47 @@
+#include "playback_clock.h"
+
+#include <esp_timer.h>
+
+void PlaybackClock::Configure(uint32_t output_latency_us) {
+    output_latency_us_ = output_latency_us;
+}
+
+void PlaybackClock::Reset() {
+    state_.store(0, std::memory_order_release);
+}
+
+void PlaybackClock::Advance(uint32_t timestamp_ms, size_t samples, int sample_rate) {
+    uint32_t end_ms = 0;
+    if (timestamp_ms != 0) {
+        end_ms = timestamp_ms + (uint32_t)((uint64_t)samples * 1000 / sample_rate);
+    }
+    uint32_t now_us = (uint32_t)esp_timer_get_time();
+    state_.store(((uint64_t)end_ms << 32) | now_us, std::memory_order_release);
+}
+
+void PlaybackClock::Stop() {
+    uint64_t state = state_.load(std::memory_order_acquire);
+    if ((state >> 32) == 0) {
+        return;
+    }
+    uint32_t elapsed_us = (uint32_t)esp_timer_get_time() - (uint32_t)state;
+    if (elapsed_us >= output_latency_us_) {
+        // Only clears the state it looked at, in case a write came in meanwhile
+        state_.compare_exchange_strong(state, 0, std::memory_order_acq_rel);
+    }
+}
+
+uint32_t PlaybackClock::Now() const {
+    uint64_t state = state_.load(std::memory_order_acquire);
+    uint32_t end_ms = state >> 32;
+    if (end_ms == 0) {
+        return 0;
+    }
+    // The codec plays what it buffered, the last sample comes out output_latency_us after the write.
+    // Past that the next write is due, until then the position holds at the end of the last one
+    uint32_t elapsed_us = (uint32_t)esp_timer_get_time() - (uint32_t)state;
+    if (elapsed_us >= output_latency_us_) {
+        return end_ms;
+    }
+    return end_ms - (output_latency_us_ - elapsed_us) / 1000;
+}
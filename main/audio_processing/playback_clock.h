@@ -0,0 +1,37 @@
+#ifndef PLAYBACK_CLOCK_H
+#define PLAYBACK_CLOCK_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Tracks which part of the server's audio stream is coming out of the speaker,
+ * from the samples handed to the codec and the time they need to drain from its
+ * output buffers. The uplink stamps each packet with it so that the server can
+ * line up its echo canceller with the reference it sent.
+ *
+ * Advance() and Stop() are called by the output task, Now() from any task.
+ */
+class PlaybackClock {
+public:
+    // output_latency_us is how long the codec takes to play the samples it buffers
+    void Configure(uint32_t output_latency_us);
+    void Reset();
+
+    // samples starting at the stream position timestamp_ms were handed to the codec.
+    // A timestamp of 0 marks local audio, such as sounds, which has no stream position
+    void Advance(uint32_t timestamp_ms, size_t samples, int sample_rate);
+    // Called while the output has nothing to write, stops the clock once the buffered samples have played
+    void Stop();
+    // Stream position in ms of the sample playing now, or 0 if no server audio is playing
+    uint32_t Now() const;
+
+private:
+    uint32_t output_latency_us_ = 0;
+    // Stream position after the last sample handed to the codec in the high word, and
+    // the time it was handed over (esp_timer, microseconds, wrapping) in the low word
+    std::atomic<uint64_t> state_{0};
+};
+
+#endif // PLAYBACK_CLOCK_H
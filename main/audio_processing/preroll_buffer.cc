@@ -0,0 +1,69 @@
+#include "preroll_buffer.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <algorithm>
+
+#define TAG "PrerollBuffer"
+
+PrerollBuffer::PrerollBuffer(int sample_rate, int duration_ms) : sample_rate_(sample_rate) {
+    size_t capacity = (size_t)sample_rate * duration_ms / 1000;
+    if (capacity == 0) {
+        return;
+    }
+    samples_ = (int16_t*)heap_caps_malloc(capacity * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+    if (samples_ == nullptr) {
+        samples_ = (int16_t*)heap_caps_malloc(capacity * sizeof(int16_t), MALLOC_CAP_8BIT);
+    }
+    if (samples_ == nullptr) {
+        ESP_LOGW(TAG, "Failed to allocate %u bytes, pre-roll is disabled", capacity * sizeof(int16_t));
+        return;
+    }
+    capacity_ = capacity;
+}
+
+PrerollBuffer::~PrerollBuffer() {
+    heap_caps_free(samples_);
+}
+
+void PrerollBuffer::Write(const int16_t* data, size_t samples, int channels) {
+    if (capacity_ == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t tail = (head_ + size_) % capacity_;
+    for (size_t i = 0; i < samples; i += channels) {
+        samples_[tail] = data[i];
+        if (++tail == capacity_) {
+            tail = 0;
+        }
+    }
+    size_t frames = samples / channels;
+    size_ += frames;
+    if (size_ > capacity_) {
+        // The oldest samples were overwritten, the ring starts right after the newest one
+        size_ = capacity_;
+        head_ = tail;
+    }
+}
+
+void PrerollBuffer::Read(std::vector<int16_t>& pcm) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pcm.resize(size_);
+    size_t first = std::min(size_, capacity_ - head_);
+    std::copy(samples_ + head_, samples_ + head_ + first, pcm.begin());
+    std::copy(samples_, samples_ + size_ - first, pcm.begin() + first);
+    head_ = 0;
+    size_ = 0;
+}
+
+void PrerollBuffer::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    head_ = 0;
+    size_ = 0;
+}
+
+int PrerollBuffer::duration_ms() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return size_ * 1000 / sample_rate_;
+}
@@ -0,0 +1,40 @@
+#ifndef PREROLL_BUFFER_H
+#define PREROLL_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/*
+ * Ring of the most recent microphone samples, so that what the user says
+ * while the audio channel opens can be sent once it is up.
+ *
+ * Write() is called from the audio input task, Read() from the encode task
+ * and Clear() from any task.
+ */
+class PrerollBuffer {
+public:
+    PrerollBuffer(int sample_rate, int duration_ms);
+    ~PrerollBuffer();
+    PrerollBuffer(const PrerollBuffer&) = delete;
+    PrerollBuffer& operator=(const PrerollBuffer&) = delete;
+
+    // Keeps the first channel of interleaved input, overwriting the oldest samples
+    void Write(const int16_t* data, size_t samples, int channels);
+    // Moves everything buffered into pcm, oldest first, and empties the buffer
+    void Read(std::vector<int16_t>& pcm);
+    void Clear();
+    // Buffered duration in milliseconds
+    int duration_ms();
+
+private:
+    std::mutex mutex_;
+    int sample_rate_;
+    int16_t* samples_ = nullptr;
+    size_t capacity_ = 0;
+    size_t head_ = 0;       // Index of the oldest sample
+    size_t size_ = 0;
+};
+
+#endif // PREROLL_BUFFER_H
@@ -0,0 +1,98 @@
+#include "silence_suppressor.h"
+
+#include <esp_log.h>
+#include <algorithm>
+#include <utility>
+
+#define TAG "SilenceSuppressor"
+
+// Frame durations below this are not used, so the held frames never need more slots
+#define SILENCE_SUPPRESSOR_MIN_FRAME_MS 20
+
+SilenceSuppressor::SilenceSuppressor(int hangover_ms, int lookback_ms, size_t headroom)
+    : hangover_ms_(hangover_ms), lookback_ms_(lookback_ms), headroom_(headroom),
+      held_(std::max(1, lookback_ms / SILENCE_SUPPRESSOR_MIN_FRAME_MS)) {
+}
+
+void SilenceSuppressor::Reset(const std::function<void(std::vector<uint8_t>& opus)>& send) {
+    // The held frames belong to the stream that ends here, the server still expects them
+    while (held_count_ > 0) {
+        SendHeld(send);
+    }
+    silence_ms_ = 0;
+    suppressing_ = false;
+    held_head_ = 0;
+    held_count_ = 0;
+}
+
+int SilenceSuppressor::saved_percent() const {
+    uint64_t encoded = encoded_bytes();
+    uint64_t sent = sent_bytes();
+    if (encoded == 0 || sent >= encoded) {
+        return 0;
+    }
+    return (encoded - sent) * 100 / encoded;
+}
+
+void SilenceSuppressor::Send(std::vector<uint8_t>& opus, const std::function<void(std::vector<uint8_t>& opus)>& send) {
+    sent_bytes_.fetch_add(opus.size() - headroom_, std::memory_order_relaxed);
+    send(opus);
+}
+
+void SilenceSuppressor::SendHeld(const std::function<void(std::vector<uint8_t>& opus)>& send) {
+    auto& frame = held_[held_head_];
+    held_head_ = (held_head_ + 1) % held_.size();
+    held_count_--;
+
+    // Packets of up to two bytes are already DTX frames from the encoder
+    if (frame.size() <= headroom_ + 2) {
+        Send(frame, send);
+        return;
+    }
+    suppressed_frames_.fetch_add(1, std::memory_order_relaxed);
+    // A TOC byte for a single frame with no data, in the same mode and frame size as the real one
+    marker_.resize(headroom_ + 1);
+    marker_[headroom_] = frame[headroom_] & 0xFC;
+    Send(marker_, send);
+}
+
+void SilenceSuppressor::Process(std::vector<uint8_t>& opus, bool voice, int frame_duration_ms,
+    const std::function<void(std::vector<uint8_t>& opus)>& send) {
+    encoded_bytes_.fetch_add(opus.size() - headroom_, std::memory_order_relaxed);
+    silence_ms_ = voice ? 0 : silence_ms_ + frame_duration_ms;
+
+    if (silence_ms_ <= hangover_ms_) {
+        if (suppressing_) {
+            suppressing_ = false;
+            // The start of the speech was held back before the VAD noticed it, no marker stood in for it
+            while (held_count_ > 0) {
+                Send(held_[held_head_], send);
+                held_head_ = (held_head_ + 1) % held_.size();
+                held_count_--;
+            }
+            held_head_ = 0;
+        }
+        Send(opus, send);
+        return;
+    }
+
+    if (!suppressing_) {
+        suppressing_ = true;
+        ESP_LOGD(TAG, "Suppressing silence after %d ms", silence_ms_);
+    }
+
+    // Hold the frame for the lookback, the one that falls out of it is replaced by a marker
+    size_t capacity = std::min(held_.size(), (size_t)(lookback_ms_ / frame_duration_ms));
+    while (held_count_ > 0 && held_count_ >= capacity) {
+        SendHeld(send);
+    }
+    if (capacity == 0) {
+        held_head_ = 0;
+        std::swap(held_[0], opus);
+        held_count_ = 1;
+        SendHeld(send);
+        return;
+    }
+    std::swap(held_[(held_head_ + held_count_) % held_.size()], opus);
+    held_count_++;
+}
@@ -0,0 +1,65 @@
+#ifndef SILENCE_SUPPRESSOR_H
+#define SILENCE_SUPPRESSOR_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/*
+ * Thins the uplink of a session that streams the microphone all the time. Once
+ * the VAD has reported silence for longer than the hangover, each encoded frame
+ * is replaced by a one byte Opus packet without audio, which the server decodes
+ * as silence, so the stream keeps its timing and the ASR endpointing still sees
+ * how long the user has been quiet.
+ *
+ * The VAD reports speech some time after it starts, so the silent frames are held
+ * back for lookback_ms and a marker is only sent once a frame falls out of that
+ * window. When speech is detected, the held frames are sent in place of their
+ * markers, so every frame is sent exactly once, either as audio or as a marker.
+ * The price is that the server sees the silence lookback_ms late, and its
+ * endpointing is delayed by as much; a lookback of 0 sends every marker at once.
+ *
+ * Process() and Reset() belong to the encode task, the byte counters may be read
+ * from any task.
+ */
+class SilenceSuppressor {
+public:
+    // Encoded frames start with headroom bytes that are not part of the Opus packet
+    SilenceSuppressor(int hangover_ms, int lookback_ms, size_t headroom = 0);
+
+    // Sends the markers of the held frames and starts a new stream, which is sent
+    // until the VAD has been silent for the hangover
+    void Reset(const std::function<void(std::vector<uint8_t>& opus)>& send);
+    // Passes an encoded frame, or the packets that replace it, to send. Build send once
+    // outside the frame loop, converting a lambda to std::function per frame may allocate
+    void Process(std::vector<uint8_t>& opus, bool voice, int frame_duration_ms,
+        const std::function<void(std::vector<uint8_t>& opus)>& send);
+
+    uint32_t encoded_bytes() const { return encoded_bytes_.load(std::memory_order_relaxed); }
+    uint32_t sent_bytes() const { return sent_bytes_.load(std::memory_order_relaxed); }
+    uint32_t suppressed_frames() const { return suppressed_frames_.load(std::memory_order_relaxed); }
+    // Share of the encoded bytes that did not have to be sent
+    int saved_percent() const;
+
+private:
+    const int hangover_ms_;
+    const int lookback_ms_;
+    const size_t headroom_;
+    int silence_ms_ = 0;
+    bool suppressing_ = false;
+    // Frames of the last lookback_ms of silence that no marker stands in for yet, oldest first from held_head_
+    std::vector<std::vector<uint8_t>> held_;
+    std::vector<uint8_t> marker_;
+    size_t held_head_ = 0;
+    size_t held_count_ = 0;
+    std::atomic<uint32_t> encoded_bytes_{0};
+    std::atomic<uint32_t> sent_bytes_{0};
+    std::atomic<uint32_t> suppressed_frames_{0};
+
+    void Send(std::vector<uint8_t>& opus, const std::function<void(std::vector<uint8_t>& opus)>& send);
+    // Sends the oldest held frame as a marker, or as is if it is already a DTX frame
+    void SendHeld(const std::function<void(std::vector<uint8_t>& opus)>& send);
+};
+
+#endif // SILENCE_SUPPRESSOR_H
@@ -0,0 +1,78 @@
+#include "sound_pcm_cache.h"
+#include "opus_fec_decoder.h"
+#include "protocol.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <arpa/inet.h>
+#include <opus_resampler.h>
+#include <cstring>
+
+#define TAG "SoundPcmCache"
+
+SoundPcmCache::SoundPcmCache() {
+    sounds_.reserve(SOUND_PCM_CACHE_MAX_SOUNDS);
+}
+
+SoundPcmCache::~SoundPcmCache() {
+    for (auto& sound : sounds_) {
+        heap_caps_free(sound.samples);
+    }
+}
+
+bool SoundPcmCache::Add(const std::string_view& sound, int sample_rate) {
+    if (Find(sound) != nullptr) {
+        return true;
+    }
+    if (sounds_.size() >= SOUND_PCM_CACHE_MAX_SOUNDS) {
+        ESP_LOGW(TAG, "The cache is full, the sound is not cached");
+        return false;
+    }
+
+    // The embedded sounds are 16kHz 60ms frames
+    OpusFecDecoder decoder(16000, 1, 60);
+    OpusResampler resampler;
+    if (sample_rate != 16000) {
+        resampler.Configure(16000, sample_rate);
+    }
+
+    std::vector<int16_t> pcm;
+    std::vector<int16_t> frame;
+    std::vector<int16_t> resampled;
+    size_t offset = 0;
+    while (offset + sizeof(BinaryProtocol3) <= sound.size()) {
+        auto p3 = (const BinaryProtocol3*)(sound.data() + offset);
+        size_t payload_size = ntohs(p3->payload_size);
+        offset += sizeof(BinaryProtocol3) + payload_size;
+        if (offset > sound.size() || !decoder.Decode(p3->payload, payload_size, frame)) {
+            ESP_LOGW(TAG, "Failed to decode the sound");
+            return false;
+        }
+        if (sample_rate != 16000) {
+            resampled.resize(resampler.GetOutputSamples(frame.size()));
+            resampler.Process(frame.data(), frame.size(), resampled.data());
+            pcm.insert(pcm.end(), resampled.begin(), resampled.end());
+        } else {
+            pcm.insert(pcm.end(), frame.begin(), frame.end());
+        }
+    }
+
+    auto samples = (int16_t*)heap_caps_malloc(pcm.size() * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+    if (samples == nullptr) {
+        ESP_LOGW(TAG, "Failed to allocate %u bytes for the sound", pcm.size() * sizeof(int16_t));
+        return false;
+    }
+    memcpy(samples, pcm.data(), pcm.size() * sizeof(int16_t));
+    sounds_.push_back(CachedSound{sound.data(), samples, pcm.size()});
+    ESP_LOGI(TAG, "Cached sound: %u samples at %d Hz", pcm.size(), sample_rate);
+    return true;
+}
+
+const CachedSound* SoundPcmCache::Find(const std::string_view& sound) const {
+    for (auto& cached : sounds_) {
+        if (cached.key == sound.data()) {
+            return &cached;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,38 @@
+#ifndef SOUND_PCM_CACHE_H
+#define SOUND_PCM_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Find() hands out pointers into the cache, so its storage is reserved once and never grows
+#define SOUND_PCM_CACHE_MAX_SOUNDS 4
+
+struct CachedSound {
+    const char* key;        // Data pointer of the embedded .p3 sound
+    int16_t* samples;       // Mono PCM at the codec output sample rate, in PSRAM
+    size_t size;
+};
+
+/*
+ * Keeps selected .p3 sounds decoded to PCM, so they can be written straight
+ * to the codec without going through the Opus decoder.
+ */
+class SoundPcmCache {
+public:
+    SoundPcmCache();
+    ~SoundPcmCache();
+    SoundPcmCache(const SoundPcmCache&) = delete;
+    SoundPcmCache& operator=(const SoundPcmCache&) = delete;
+
+    // Decodes the sound, this takes tens of milliseconds and a large stack.
+    // Fails once SOUND_PCM_CACHE_MAX_SOUNDS sounds are cached
+    bool Add(const std::string_view& sound, int sample_rate);
+    const CachedSound* Find(const std::string_view& sound) const;
+
+private:
+    std::vector<CachedSound> sounds_;
+};
+
+#endif // SOUND_PCM_CACHE_H
@@ -14,6 +14,8 @@ public:
     virtual void Initialize(AudioCodec* codec) = 0;
     virtual void Feed(const std::vector<int16_t>& data) = 0;
     virtual void OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) = 0;
+    // Speech activity seen by the detection front end, while detection is running
+    virtual void OnVadStateChange(std::function<void(bool speaking)> callback) = 0;
     virtual void StartDetection() = 0;
     virtual void StopDetection() = 0;
     virtual bool IsDetectionRunning() = 0;
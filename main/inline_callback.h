@@ -0,0 +1,92 @@
+#ifndef INLINE_CALLBACK_H
+#define INLINE_CALLBACK_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/*
+ * A void() callable stored in a fixed buffer inside the object, so unlike
+ * std::function it never allocates. Callables larger than Capacity are
+ * rejected at compile time.
+ */
+template <size_t Capacity>
+class InlineCallback {
+public:
+    InlineCallback() = default;
+
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, InlineCallback>>>
+    InlineCallback(F&& callable) {
+        Assign(std::forward<F>(callable));
+    }
+
+    InlineCallback(InlineCallback&& other) noexcept {
+        MoveFrom(other);
+    }
+
+    InlineCallback& operator=(InlineCallback&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    InlineCallback(const InlineCallback&) = delete;
+    InlineCallback& operator=(const InlineCallback&) = delete;
+
+    ~InlineCallback() {
+        Reset();
+    }
+
+    template <typename F>
+    void Assign(F&& callable) {
+        using Callable = std::decay_t<F>;
+        static_assert(sizeof(Callable) <= Capacity, "The callable captures too much, capture less or raise the capacity");
+        static_assert(alignof(Callable) <= alignof(std::max_align_t), "The callable is over-aligned");
+        Reset();
+        new (storage_) Callable(std::forward<F>(callable));
+        ops_ = &kOps<Callable>;
+    }
+
+    void Reset() {
+        if (ops_ != nullptr) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    void operator()() { ops_->invoke(storage_); }
+    explicit operator bool() const { return ops_ != nullptr; }
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        void (*move)(void* to, void* from);
+        void (*destroy)(void* storage);
+    };
+
+    template <typename Callable>
+    static constexpr Ops kOps = {
+        [](void* storage) { (*static_cast<Callable*>(storage))(); },
+        [](void* to, void* from) {
+            new (to) Callable(std::move(*static_cast<Callable*>(from)));
+            static_cast<Callable*>(from)->~Callable();
+        },
+        [](void* storage) { static_cast<Callable*>(storage)->~Callable(); },
+    };
+
+    alignas(std::max_align_t) unsigned char storage_[Capacity];
+    const Ops* ops_ = nullptr;
+
+    void MoveFrom(InlineCallback& other) {
+        if (other.ops_ != nullptr) {
+            other.ops_->move(storage_, other.storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+};
+
+#endif // INLINE_CALLBACK_H
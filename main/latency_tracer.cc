@@ -0,0 +1,126 @@
+#include "latency_tracer.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cJSON.h>
+
+#define TAG "LatencyTracer"
+
+// Offsets that have not been marked in the current turn
+#define LATENCY_NOT_MARKED UINT32_MAX
+
+static const char* const EVENT_NAMES[kLatencyEventCount] = {
+    "wake_word",
+    "channel_open_start",
+    "channel_open_end",
+    "server_hello",
+    "first_send_audio",
+    "listen_stop",
+    "tts_start",
+    "first_incoming_audio",
+    "first_decoded_frame",
+    "first_output",
+};
+
+LatencyTracer::LatencyTracer() {
+    ResetCurrent();
+}
+
+void LatencyTracer::ResetCurrent() {
+    // Move the start first, so a Mark() racing with the reset never measures from the previous turn
+    turn_start_us_.store((uint32_t)esp_timer_get_time());
+    for (auto& offset : offsets_us_) {
+        offset.store(LATENCY_NOT_MARKED);
+    }
+}
+
+LatencyTracer::Turn LatencyTracer::SnapshotCurrent() {
+    Turn turn;
+    turn.id = turn_id_;
+    for (int i = 0; i < kLatencyEventCount; i++) {
+        turn.offsets_us[i] = offsets_us_[i].load(std::memory_order_relaxed);
+    }
+    return turn;
+}
+
+void LatencyTracer::BeginTurn() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Turn turn = SnapshotCurrent();
+    bool recorded = false;
+    for (auto offset : turn.offsets_us) {
+        recorded |= offset != LATENCY_NOT_MARKED;
+    }
+    if (recorded) {
+        turns_[turn_id_ % LATENCY_TRACER_MAX_TURNS] = turn;
+        if (turn_count_ < LATENCY_TRACER_MAX_TURNS) {
+            turn_count_++;
+        }
+        LogTurn(turn);
+        turn_id_++;
+    }
+    ResetCurrent();
+}
+
+void LatencyTracer::Mark(LatencyEvent event) {
+    auto& offset = offsets_us_[event];
+    if (offset.load(std::memory_order_relaxed) != LATENCY_NOT_MARKED) {
+        return;
+    }
+    uint32_t start = turn_start_us_.load();
+    uint32_t now = (uint32_t)esp_timer_get_time() - start;
+    if (now == LATENCY_NOT_MARKED) {
+        now--;
+    }
+    uint32_t expected = LATENCY_NOT_MARKED;
+    if (offset.compare_exchange_strong(expected, now) && turn_start_us_.load() != start) {
+        // A new turn began meanwhile, the offset belongs to the old one
+        expected = now;
+        offset.compare_exchange_strong(expected, LATENCY_NOT_MARKED);
+    }
+}
+
+void LatencyTracer::LogTurn(const Turn& turn) {
+    std::string line;
+    for (int i = 0; i < kLatencyEventCount; i++) {
+        if (turn.offsets_us[i] != LATENCY_NOT_MARKED) {
+            line += " ";
+            line += EVENT_NAMES[i];
+            line += "=" + std::to_string(turn.offsets_us[i] / 1000);
+        }
+    }
+    ESP_LOGI(TAG, "Turn %lu (ms):%s", turn.id, line.c_str());
+}
+
+std::string LatencyTracer::GetJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cJSON* root = cJSON_CreateArray();
+    auto add_turn = [root](const Turn& turn) {
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "turn", turn.id);
+        for (int i = 0; i < kLatencyEventCount; i++) {
+            if (turn.offsets_us[i] != LATENCY_NOT_MARKED) {
+                cJSON_AddNumberToObject(item, EVENT_NAMES[i], turn.offsets_us[i] / 1000);
+            }
+        }
+        cJSON_AddItemToArray(root, item);
+    };
+    for (int i = turn_count_; i > 0; i--) {
+        add_turn(turns_[(turn_id_ - i) % LATENCY_TRACER_MAX_TURNS]);
+    }
+    add_turn(SnapshotCurrent());
+
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return json;
+}
+
+void LatencyTracer::Dump() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ESP_LOGI(TAG, "Last %d turns:", turn_count_);
+    for (int i = turn_count_; i > 0; i--) {
+        LogTurn(turns_[(turn_id_ - i) % LATENCY_TRACER_MAX_TURNS]);
+    }
+    LogTurn(SnapshotCurrent());
+}
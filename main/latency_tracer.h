@@ -0,0 +1,69 @@
+#ifndef _LATENCY_TRACER_H_
+#define _LATENCY_TRACER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// Number of finished turns kept for GetJson() and Dump()
+#define LATENCY_TRACER_MAX_TURNS 8
+
+enum LatencyEvent {
+    kLatencyWakeWord,
+    kLatencyChannelOpenStart,
+    kLatencyChannelOpenEnd,
+    kLatencyServerHello,
+    kLatencyFirstSendAudio,
+    kLatencyListenStop,
+    kLatencyTtsStart,
+    kLatencyFirstIncomingAudio,
+    kLatencyFirstDecodedFrame,
+    kLatencyFirstOutput,
+    kLatencyEventCount
+};
+
+/*
+ * Records when each step of a voice turn first happened, relative to the
+ * start of the turn. Mark() is lock-free and costs a timer read and an
+ * atomic compare-and-swap, so it is safe to call from the audio tasks.
+ */
+class LatencyTracer {
+public:
+    static LatencyTracer& GetInstance() {
+        static LatencyTracer instance;
+        return instance;
+    }
+    LatencyTracer(const LatencyTracer&) = delete;
+    LatencyTracer& operator=(const LatencyTracer&) = delete;
+
+    // Finishes the current turn, if anything was recorded, and starts a new one
+    void BeginTurn();
+    // Only the first mark of each event in a turn is kept
+    void Mark(LatencyEvent event);
+
+    // The finished turns and the current one, oldest first, times in milliseconds
+    std::string GetJson();
+    void Dump();
+
+private:
+    LatencyTracer();
+
+    struct Turn {
+        uint32_t id;
+        uint32_t offsets_us[kLatencyEventCount];
+    };
+
+    std::mutex mutex_;
+    std::atomic<uint32_t> turn_start_us_{0};
+    std::atomic<uint32_t> offsets_us_[kLatencyEventCount];
+    uint32_t turn_id_ = 0;
+    Turn turns_[LATENCY_TRACER_MAX_TURNS];
+    int turn_count_ = 0;
+
+    void ResetCurrent();
+    Turn SnapshotCurrent();
+    void LogTurn(const Turn& turn);
+};
+
+#endif // _LATENCY_TRACER_H_
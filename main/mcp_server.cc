@@ -13,6 +13,7 @@
 #include "application.h"
 #include "display.h"
 #include "board.h"
+#include "latency_tracer.h"
 
 #define TAG "MCP"
 
@@ -42,7 +43,26 @@ void McpServer::AddCommonTools() {
         "2. As the first step to control the device (e.g. turn up / down the volume of the audio speaker, etc.)",
         PropertyList(),
         [&board](const PropertyList& properties) -> ReturnValue {
-            return board.GetDeviceStatusJson();
+            auto status = board.GetDeviceStatusJson();
+            // Add the uplink encoder operating point, so that it can be matched with audio quality reports
+            cJSON* root = cJSON_Parse(status.c_str());
+            if (root == nullptr) {
+                return status;
+            }
+            auto encoder = Application::GetInstance().GetAudioEncoderStatus();
+            cJSON* audio_encoder = cJSON_CreateObject();
+            cJSON_AddNumberToObject(audio_encoder, "frame_duration", encoder.frame_duration);
+            cJSON_AddNumberToObject(audio_encoder, "complexity", encoder.complexity);
+            cJSON_AddNumberToObject(audio_encoder, "bitrate", encoder.bitrate);
+            cJSON_AddNumberToObject(audio_encoder, "cpu_percent", encoder.cpu_percent);
+            cJSON_AddNumberToObject(audio_encoder, "dtx_saved_percent", encoder.dtx_saved_percent);
+            cJSON_AddNumberToObject(audio_encoder, "dtx_marker_delay_ms", encoder.dtx_marker_delay_ms);
+            cJSON_AddItemToObject(root, "audio_encoder", audio_encoder);
+            auto json_str = cJSON_PrintUnformatted(root);
+            std::string json(json_str);
+            cJSON_free(json_str);
+            cJSON_Delete(root);
+            return json;
         });
 
     AddTool("self.audio_speaker.set_volume", 
@@ -103,6 +123,19 @@ void McpServer::AddCommonTools() {
             });
     }
 
+    AddTool("self.get_latency_traces",
+        "Provides the timing of the latest voice conversation turns, for diagnosing slow responses.\n"
+        "Return:\n"
+        "  A JSON array of turns, oldest first. Each turn gives the milliseconds from its start to the wake word, "
+        "audio channel open start / end, server hello, first audio sent, listen stop, tts start, "
+        "first audio received, first frame decoded and first frame played.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto& tracer = LatencyTracer::GetInstance();
+            tracer.Dump();
+            return tracer.GetJson();
+        });
+
     // Restore the original tools list to the end of the tools list
     tools_.insert(tools_.end(), original_tools.begin(), original_tools.end());
 }
@@ -0,0 +1,86 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+/*
+ * Bounded lock-free multi-producer / single-consumer queue (D. Vyukov's
+ * bounded queue). Every cell is allocated up front and carries a sequence
+ * number that tells producers and the consumer whose turn it is, so Push()
+ * only needs one compare-and-swap and Pop() none.
+ *
+ * Push() may be called from any task, Pop() from one consumer task only.
+ */
+template <typename T>
+class MpscQueue {
+public:
+    explicit MpscQueue(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        cells_.reset(new Cell[size]);
+        mask_ = size - 1;
+        for (size_t i = 0; i < size; i++) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    // Any task. Returns false if the queue is full.
+    bool Push(T&& item) {
+        Cell* cell;
+        uint32_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells_[pos & mask_];
+            uint32_t sequence = cell->sequence.load(std::memory_order_acquire);
+            int32_t diff = (int32_t)(sequence - pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->item = std::move(item);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side
+    bool Pop(T& item) {
+        Cell& cell = cells_[dequeue_pos_ & mask_];
+        uint32_t sequence = cell.sequence.load(std::memory_order_acquire);
+        if ((int32_t)(sequence - (dequeue_pos_ + 1)) < 0) {
+            return false;
+        }
+        item = std::move(cell.item);
+        cell.sequence.store(dequeue_pos_ + mask_ + 1, std::memory_order_release);
+        dequeue_pos_++;
+        return true;
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+
+private:
+    struct Cell {
+        std::atomic<uint32_t> sequence;
+        T item;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    uint32_t mask_ = 0;
+    std::atomic<uint32_t> enqueue_pos_{0};
+    uint32_t dequeue_pos_ = 0;
+};
+
+#endif // MPSC_QUEUE_H
@@ -0,0 +1,63 @@
+#include "audio_packet_pool.h"
+
+#include <algorithm>
+#include <utility>
+
+AudioPacketPool::AudioPacketPool(int count, int max_count, size_t buffer_size)
+    : buffer_size_(buffer_size), free_(std::max(count, max_count)) {
+    for (int i = 0; i < count; i++) {
+        free_[i].reserve(buffer_size);
+    }
+    free_count_ = count;
+    min_free_ = count;
+    allocated_ = count;
+}
+
+void AudioPacketPool::Acquire(std::vector<uint8_t>& buffer) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_count_ > 0) {
+            free_count_--;
+            if (free_count_ < min_free_) {
+                min_free_ = free_count_;
+            }
+            buffer.clear();
+            std::swap(buffer, free_[free_count_]);
+            return;
+        }
+        exhausted_++;
+        if (allocated_ < (int)free_.size()) {
+            allocated_++;
+        }
+    }
+    buffer.clear();
+    buffer.reserve(buffer_size_);
+}
+
+void AudioPacketPool::Release(std::vector<uint8_t>& buffer) {
+    if (buffer.capacity() < buffer_size_) {
+        return;
+    }
+    buffer.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_count_ < (int)free_.size()) {
+        std::swap(buffer, free_[free_count_]);
+        free_count_++;
+    }
+}
+
+void AudioPacketPool::CountOversized() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    oversized_++;
+}
+
+AudioPacketPoolStats AudioPacketPool::GetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return AudioPacketPoolStats{
+        .free = free_count_,
+        .allocated = allocated_,
+        .min_free = min_free_,
+        .exhausted = exhausted_,
+        .oversized = oversized_,
+    };
+}
@@ -0,0 +1,67 @@
+#ifndef AUDIO_PACKET_POOL_H
+#define AUDIO_PACKET_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Buffers allocated up front for incoming audio packets, enough for the jitter buffer's deepest target and a burst
+#define AUDIO_PACKET_POOL_SIZE 24
+// Buffers the pool keeps at most: one for every slot of the jitter buffer (MAX_AUDIO_PACKETS_IN_QUEUE
+// rounded up to a power of two), the packet being received and the one being decoded
+#define AUDIO_PACKET_POOL_MAX_SIZE (64 + 2)
+// Capacity of each buffer, an Opus frame of 60 ms at up to 64 kbit/s
+#define AUDIO_PACKET_BUFFER_SIZE 512
+
+struct AudioPacketPoolStats {
+    int free;               // Buffers ready for the next packets
+    int allocated;          // Buffers the pool has handed out or holds, up to its max_count
+    int min_free;           // Fewest buffers that were ever free
+    uint32_t exhausted;     // Packets that arrived while the pool was empty and got a new buffer
+    uint32_t oversized;     // Packets larger than a pooled buffer
+};
+
+/*
+ * Set of equally sized buffers for incoming audio packets, so that a long reply
+ * does not allocate and free a vector per packet. The network task acquires a
+ * buffer for each packet, and whoever is done with the packet, normally the
+ * decode task, releases it.
+ *
+ * count buffers are allocated up front. When more are in use at once, Acquire()
+ * allocates a new one, and the pool keeps it once it is released, up to
+ * max_count buffers, so only the deepest burst so far allocates. max_count has
+ * to cover every place a buffer can wait in: a buffer the pool does not take
+ * back stays with the caller, ends up in a jitter buffer slot, and the pool
+ * allocates another one in its place.
+ *
+ * Buffers move in and out by swapping vectors, so the caller gets back whatever
+ * vector was in the pool's slot.
+ */
+class AudioPacketPool {
+public:
+    AudioPacketPool(int count, int max_count, size_t buffer_size);
+
+    // Swaps an empty pooled buffer into buffer, or reserves a new one if the pool is exhausted
+    void Acquire(std::vector<uint8_t>& buffer);
+    // Takes the buffer back into the pool and leaves an unused vector in its place. Buffers
+    // smaller than buffer_size, or offered while the pool holds max_count buffers, are left as is
+    void Release(std::vector<uint8_t>& buffer);
+    // Counts a packet that did not fit into a pooled buffer
+    void CountOversized();
+
+    AudioPacketPoolStats GetStats();
+    size_t buffer_size() const { return buffer_size_; }
+
+private:
+    std::mutex mutex_;
+    const size_t buffer_size_;
+    std::vector<std::vector<uint8_t>> free_;
+    int free_count_ = 0;
+    int allocated_ = 0;
+    int min_free_ = 0;
+    uint32_t exhausted_ = 0;
+    uint32_t oversized_ = 0;
+};
+
+#endif // AUDIO_PACKET_POOL_H
@@ -1,6 +1,7 @@
 #include "mqtt_protocol.h"
 #include "board.h"
 #include "application.h"
+#include "latency_tracer.h"
 #include "settings.h"
 
 #include <esp_log.h>
@@ -122,25 +123,64 @@ bool MqttProtocol::SendText(const std::string& text) {
     return true;
 }
 
-bool MqttProtocol::SendAudio(const AudioStreamPacket& packet) {
+bool MqttProtocol::SendAudio(AudioStreamPacket& packet) {
     std::lock_guard<std::mutex> lock(channel_mutex_);
     if (udp_ == nullptr) {
         return false;
     }
 
+    // The datagram is handed to the socket as a string, so the encrypted audio is always copied once
+    size_t size = packet.audio_size();
+    audio_bytes_sent_ += size;
+    audio_bytes_copied_ += size;
     std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(packet.payload.size());
+    *(uint16_t*)&nonce[2] = htons(size);
     *(uint32_t*)&nonce[8] = htonl(packet.timestamp);
     *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
 
     std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + packet.payload.size());
+    encrypted.resize(aes_nonce_.size() + size);
     memcpy(encrypted.data(), nonce.data(), nonce.size());
 
     size_t nc_off = 0;
     uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet.payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)packet.payload.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
+    if (mbedtls_aes_crypt_ctr(&aes_ctx_, size, &nc_off, (uint8_t*)nonce.c_str(), stream_block,
+        packet.audio_data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
+        ESP_LOGE(TAG, "Failed to encrypt audio data");
+        return false;
+    }
+
+    return udp_->Send(encrypted) > 0;
+}
+
+bool MqttProtocol::SendAudioFrames(AudioStreamPacket* packets, size_t count) {
+    if (!audio_aggregation_ || count < 2) {
+        return Protocol::SendAudioFrames(packets, count);
+    }
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    if (udp_ == nullptr) {
+        return false;
+    }
+
+    size_t frames_size = GetAudioFramesSize(packets, count);
+    audio_bytes_sent_ += frames_size - count * sizeof(uint16_t);
+    audio_bytes_copied_ += frames_size - count * sizeof(uint16_t);
+    std::string nonce(aes_nonce_);
+    nonce[0] = MQTT_UDP_PACKET_AUDIO_FRAMES;
+    *(uint16_t*)&nonce[2] = htons(frames_size);
+    *(uint32_t*)&nonce[8] = htonl(packets[0].timestamp);
+    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
+
+    // Packed in place after the nonce, then encrypted in place
+    std::string encrypted;
+    encrypted.resize(nonce.size() + frames_size);
+    memcpy(encrypted.data(), nonce.data(), nonce.size());
+    auto frames = (uint8_t*)&encrypted[nonce.size()];
+    WriteAudioFrames(packets, count, frames);
+
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    if (mbedtls_aes_crypt_ctr(&aes_ctx_, frames_size, &nc_off, (uint8_t*)nonce.c_str(), stream_block, frames, frames) != 0) {
         ESP_LOGE(TAG, "Failed to encrypt audio data");
         return false;
     }
@@ -169,6 +209,7 @@ void MqttProtocol::CloseAudioChannel() {
 }
 
 bool MqttProtocol::OpenAudioChannel() {
+    LatencyTracer::GetInstance().Mark(kLatencyChannelOpenStart);
     if (mqtt_ == nullptr || !mqtt_->IsConnected()) {
         ESP_LOGI(TAG, "MQTT is not connected, try to connect now");
         if (!StartMqttClient(true)) {
@@ -214,11 +255,10 @@ bool MqttProtocol::OpenAudioChannel() {
         }
         uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
-            return;
-        }
-        if (sequence != remote_sequence_ + 1) {
+        // Out of order packets are passed on, the jitter buffer puts them back in order
+        if (sequence <= remote_sequence_) {
+            ESP_LOGW(TAG, "Received audio packet out of order: %lu, latest: %lu", sequence, remote_sequence_);
+        } else if (sequence != remote_sequence_ + 1) {
             ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
         }
 
@@ -231,21 +271,24 @@ bool MqttProtocol::OpenAudioChannel() {
         packet.sample_rate = server_sample_rate_;
         packet.frame_duration = server_frame_duration_;
         packet.timestamp = timestamp;
-        packet.payload.resize(decrypted_size);
+        packet.sequence = sequence;
+        AcquireAudioBuffer(packet, decrypted_size);
         int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)packet.payload.data());
         if (ret != 0) {
             ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
+            ReleaseAudioBuffer(packet.payload);
             return;
         }
-        if (on_incoming_audio_ != nullptr) {
-            on_incoming_audio_(std::move(packet));
+        DeliverIncomingAudio(packet);
+        if (sequence > remote_sequence_) {
+            remote_sequence_ = sequence;
         }
-        remote_sequence_ = sequence;
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
     udp_->Connect(udp_server_, udp_port_);
 
+    LatencyTracer::GetInstance().Mark(kLatencyChannelOpenEnd);
     if (on_audio_channel_opened_ != nullptr) {
         on_audio_channel_opened_();
     }
@@ -259,18 +302,14 @@ std::string MqttProtocol::GetHelloMessage() {
     cJSON_AddNumberToObject(root, "version", 3);
     cJSON_AddStringToObject(root, "transport", "udp");
     cJSON* features = cJSON_CreateObject();
-#if CONFIG_USE_SERVER_AEC
-    cJSON_AddBoolToObject(features, "aec", true);
-#endif
-#if CONFIG_IOT_PROTOCOL_MCP
-    cJSON_AddBoolToObject(features, "mcp", true);
-#endif
+    AddClientFeatures(features);
     cJSON_AddItemToObject(root, "features", features);
     cJSON* audio_params = cJSON_CreateObject();
     cJSON_AddStringToObject(audio_params, "format", "opus");
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
     cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
+    cJSON_AddNumberToObject(audio_params, "frame_duration", Application::GetInstance().GetUplinkFrameDuration());
+    cJSON_AddBoolToObject(audio_params, "fec", true);
     cJSON_AddItemToObject(root, "audio_params", audio_params);
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
@@ -280,6 +319,7 @@ std::string MqttProtocol::GetHelloMessage() {
 }
 
 void MqttProtocol::ParseServerHello(const cJSON* root) {
+    LatencyTracer::GetInstance().Mark(kLatencyServerHello);
     auto transport = cJSON_GetObjectItem(root, "transport");
     if (transport == nullptr || strcmp(transport->valuestring, "udp") != 0) {
         ESP_LOGE(TAG, "Unsupported transport: %s", transport->valuestring);
@@ -322,6 +362,7 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
     mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
     local_sequence_ = 0;
     remote_sequence_ = 0;
+    ParseServerFeatures(root);
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
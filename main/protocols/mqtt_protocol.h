@@ -19,6 +19,8 @@
 #define MQTT_RECONNECT_INTERVAL_MS 10000
 
 #define MQTT_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
+// Packet type in the first nonce byte for several Opus frames in one datagram, 0x01 is a single frame
+#define MQTT_UDP_PACKET_AUDIO_FRAMES 0x02
 
 class MqttProtocol : public Protocol {
 public:
@@ -26,7 +28,8 @@ public:
     ~MqttProtocol();
 
     bool Start() override;
-    bool SendAudio(const AudioStreamPacket& packet) override;
+    bool SendAudio(AudioStreamPacket& packet) override;
+    bool SendAudioFrames(AudioStreamPacket* packets, size_t count) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
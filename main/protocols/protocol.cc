@@ -1,6 +1,9 @@
 #include "protocol.h"
 
+#include "latency_tracer.h"
+
 #include <esp_log.h>
+#include <cstring>
 
 #define TAG "Protocol"
 
@@ -24,6 +27,72 @@ void Protocol::OnNetworkError(std::function<void(const std::string& message)> ca
     on_network_error_ = callback;
 }
 
+void Protocol::AddClientFeatures(cJSON* features) {
+#if CONFIG_USE_SERVER_AEC
+    cJSON_AddBoolToObject(features, "aec", true);
+#endif
+#if CONFIG_IOT_PROTOCOL_MCP
+    cJSON_AddBoolToObject(features, "mcp", true);
+#endif
+#if CONFIG_USE_UPLINK_AGGREGATION
+    cJSON_AddBoolToObject(features, "audio_aggregation", true);
+#endif
+}
+
+void Protocol::ParseServerFeatures(const cJSON* root) {
+    audio_aggregation_ = false;
+#if CONFIG_USE_UPLINK_AGGREGATION
+    auto features = cJSON_GetObjectItem(root, "features");
+    if (cJSON_IsObject(features)) {
+        audio_aggregation_ = cJSON_IsTrue(cJSON_GetObjectItem(features, "audio_aggregation"));
+    }
+    ESP_LOGI(TAG, "Audio aggregation %s by the server", audio_aggregation_ ? "accepted" : "not supported");
+#endif
+}
+
+void Protocol::AcquireAudioBuffer(AudioStreamPacket& packet, size_t size) {
+    audio_packet_pool_.Acquire(packet.payload);
+    if (size > audio_packet_pool_.buffer_size()) {
+        audio_packet_pool_.CountOversized();
+    }
+    packet.payload.resize(size);
+}
+
+void Protocol::DeliverIncomingAudio(AudioStreamPacket& packet) {
+    if (on_incoming_audio_ != nullptr) {
+        // The jitter buffer swaps the packet into a slot, handing back the buffer the slot had
+        on_incoming_audio_(std::move(packet));
+    }
+    audio_packet_pool_.Release(packet.payload);
+}
+
+bool Protocol::SendAudioFrames(AudioStreamPacket* packets, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (!SendAudio(packets[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t Protocol::GetAudioFramesSize(const AudioStreamPacket* packets, size_t count) {
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++) {
+        size += sizeof(uint16_t) + packets[i].audio_size();
+    }
+    return size;
+}
+
+void Protocol::WriteAudioFrames(const AudioStreamPacket* packets, size_t count, uint8_t* dest) {
+    for (size_t i = 0; i < count; i++) {
+        size_t size = packets[i].audio_size();
+        *dest++ = size >> 8;
+        *dest++ = size & 0xFF;
+        memcpy(dest, packets[i].audio_data(), size);
+        dest += size;
+    }
+}
+
 void Protocol::SetError(const std::string& message) {
     error_occurred_ = true;
     if (on_network_error_ != nullptr) {
@@ -61,6 +130,7 @@ void Protocol::SendStartListening(ListeningMode mode) {
 }
 
 void Protocol::SendStopListening() {
+    LatencyTracer::GetInstance().Mark(kLatencyListenStop);
     std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"stop\"}";
     SendText(message);
 }
@@ -7,22 +7,50 @@
 #include <chrono>
 #include <vector>
 
+#include "audio_packet_pool.h"
+
+// Bytes the uplink encoder reserves in front of each Opus frame, so that the transport can
+// write its header in place. Fits BinaryProtocol2, BinaryProtocol3 and the UDP nonce
+#define AUDIO_PACKET_HEADROOM 16
+
 struct AudioStreamPacket {
     int sample_rate = 0;
     int frame_duration = 0;
     uint32_t timestamp = 0;
+    uint32_t sequence = 0;
+    // Local time the packet was received in microseconds, set by the jitter buffer
+    int64_t arrival_time = 0;
     std::vector<uint8_t> payload;
+    // Unused bytes at the start of the payload, before the Opus data
+    uint16_t headroom = 0;
+
+    uint8_t* audio_data() { return payload.data() + headroom; }
+    const uint8_t* audio_data() const { return payload.data() + headroom; }
+    size_t audio_size() const { return payload.size() - headroom; }
 };
 
 struct BinaryProtocol2 {
     uint16_t version;
-    uint16_t type;          // Message type (0: OPUS, 1: JSON)
+    uint16_t type;          // Message type (0: OPUS, 1: JSON, 2: OPUS frames, see below)
     uint32_t reserved;      // Reserved for future use
     uint32_t timestamp;     // Timestamp in milliseconds (used for server-side AEC)
     uint32_t payload_size;  // Payload size in bytes
     uint8_t payload[];      // Payload data
 } __attribute__((packed));
 
+/*
+ * Audio message types. A message of kBinaryTypeOpusFrames carries several
+ * consecutive Opus frames, each preceded by its size as a big-endian uint16.
+ * The timestamp in the header is the one of the first frame. Over UDP the
+ * packet type byte of the nonce is MQTT_UDP_PACKET_AUDIO_FRAMES instead. It is
+ * only sent to servers that accept "audio_aggregation" in their hello features.
+ */
+enum BinaryMessageType {
+    kBinaryTypeOpus = 0,
+    kBinaryTypeJson = 1,
+    kBinaryTypeOpusFrames = 2,
+};
+
 struct BinaryProtocol3 {
     uint8_t type;
     uint8_t reserved;
@@ -54,6 +82,16 @@ public:
     inline const std::string& session_id() const {
         return session_id_;
     }
+    inline bool audio_aggregation() const {
+        return audio_aggregation_;
+    }
+    // Opus bytes sent, and how many of them had to be copied into a message buffer
+    inline uint32_t audio_bytes_sent() const {
+        return audio_bytes_sent_;
+    }
+    inline uint32_t audio_bytes_copied() const {
+        return audio_bytes_copied_;
+    }
 
     void OnIncomingAudio(std::function<void(AudioStreamPacket&& packet)> callback);
     void OnIncomingJson(std::function<void(const cJSON* root)> callback);
@@ -65,7 +103,10 @@ public:
     virtual bool OpenAudioChannel() = 0;
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
-    virtual bool SendAudio(const AudioStreamPacket& packet) = 0;
+    // The transport may write its header into the headroom of the packet
+    virtual bool SendAudio(AudioStreamPacket& packet) = 0;
+    // Sends consecutive packets, packed into one message if the server accepted aggregation
+    virtual bool SendAudioFrames(AudioStreamPacket* packets, size_t count);
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
@@ -74,6 +115,14 @@ public:
     virtual void SendIotStates(const std::string& states);
     virtual void SendMcpMessage(const std::string& message);
 
+    // Returns the payload buffer of an incoming packet once it has been decoded
+    void ReleaseAudioBuffer(std::vector<uint8_t>& buffer) {
+        audio_packet_pool_.Release(buffer);
+    }
+    AudioPacketPoolStats GetAudioPacketPoolStats() {
+        return audio_packet_pool_.GetStats();
+    }
+
 protected:
     std::function<void(const cJSON* root)> on_incoming_json_;
     std::function<void(AudioStreamPacket&& packet)> on_incoming_audio_;
@@ -84,10 +133,22 @@ protected:
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
     bool error_occurred_ = false;
+    bool audio_aggregation_ = false;
+    uint32_t audio_bytes_sent_ = 0;
+    uint32_t audio_bytes_copied_ = 0;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
+    AudioPacketPool audio_packet_pool_{AUDIO_PACKET_POOL_SIZE, AUDIO_PACKET_POOL_MAX_SIZE, AUDIO_PACKET_BUFFER_SIZE};
 
     virtual bool SendText(const std::string& text) = 0;
+    void AddClientFeatures(cJSON* features);
+    // Gives packet a pooled buffer of size bytes for the incoming audio
+    void AcquireAudioBuffer(AudioStreamPacket& packet, size_t size);
+    // Passes the packet to the application, and pools the buffer it leaves behind
+    void DeliverIncomingAudio(AudioStreamPacket& packet);
+    void ParseServerFeatures(const cJSON* root);
+    static size_t GetAudioFramesSize(const AudioStreamPacket* packets, size_t count);
+    static void WriteAudioFrames(const AudioStreamPacket* packets, size_t count, uint8_t* dest);
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
 };
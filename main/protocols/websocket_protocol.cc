@@ -2,6 +2,7 @@
 #include "board.h"
 #include "system_info.h"
 #include "application.h"
+#include "latency_tracer.h"
 #include "settings.h"
 
 #include <cstring>
@@ -28,36 +29,76 @@ bool WebsocketProtocol::Start() {
     return true;
 }
 
-bool WebsocketProtocol::SendAudio(const AudioStreamPacket& packet) {
+bool WebsocketProtocol::SendAudio(AudioStreamPacket& packet) {
     if (websocket_ == nullptr) {
         return false;
     }
 
+    size_t size = packet.audio_size();
+    audio_bytes_sent_ += size;
     if (version_ == 2) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol2) + packet.payload.size());
-        auto bp2 = (BinaryProtocol2*)serialized.data();
+        // The header goes in front of the Opus data if the encoder left room for it
+        uint8_t* message = PrepareAudioMessage(packet, sizeof(BinaryProtocol2));
+        auto bp2 = (BinaryProtocol2*)message;
         bp2->version = htons(version_);
-        bp2->type = 0;
+        bp2->type = htons(kBinaryTypeOpus);
         bp2->reserved = 0;
         bp2->timestamp = htonl(packet.timestamp);
-        bp2->payload_size = htonl(packet.payload.size());
-        memcpy(bp2->payload, packet.payload.data(), packet.payload.size());
-
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        bp2->payload_size = htonl(size);
+        return websocket_->Send(message, sizeof(BinaryProtocol2) + size, true);
     } else if (version_ == 3) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol3) + packet.payload.size());
-        auto bp3 = (BinaryProtocol3*)serialized.data();
-        bp3->type = 0;
+        uint8_t* message = PrepareAudioMessage(packet, sizeof(BinaryProtocol3));
+        auto bp3 = (BinaryProtocol3*)message;
+        bp3->type = kBinaryTypeOpus;
         bp3->reserved = 0;
-        bp3->payload_size = htons(packet.payload.size());
-        memcpy(bp3->payload, packet.payload.data(), packet.payload.size());
+        bp3->payload_size = htons(size);
+        return websocket_->Send(message, sizeof(BinaryProtocol3) + size, true);
+    } else {
+        return websocket_->Send(packet.audio_data(), size, true);
+    }
+}
+
+uint8_t* WebsocketProtocol::PrepareAudioMessage(AudioStreamPacket& packet, size_t header_size) {
+    if (packet.headroom >= header_size) {
+        return packet.audio_data() - header_size;
+    }
+    // Packets without headroom, such as the wake word audio, are copied behind the header
+    send_buffer_.resize(header_size + packet.audio_size());
+    memcpy(send_buffer_.data() + header_size, packet.audio_data(), packet.audio_size());
+    audio_bytes_copied_ += packet.audio_size();
+    return send_buffer_.data();
+}
 
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+bool WebsocketProtocol::SendAudioFrames(AudioStreamPacket* packets, size_t count) {
+    if (!audio_aggregation_ || count < 2) {
+        return Protocol::SendAudioFrames(packets, count);
+    }
+    if (websocket_ == nullptr) {
+        return false;
+    }
+
+    // Packed into the persistent send buffer, which only grows for the largest batch
+    size_t frames_size = GetAudioFramesSize(packets, count);
+    if (version_ == 2) {
+        send_buffer_.resize(sizeof(BinaryProtocol2) + frames_size);
+        auto bp2 = (BinaryProtocol2*)send_buffer_.data();
+        bp2->version = htons(version_);
+        bp2->type = htons(kBinaryTypeOpusFrames);
+        bp2->reserved = 0;
+        bp2->timestamp = htonl(packets[0].timestamp);
+        bp2->payload_size = htonl(frames_size);
+        WriteAudioFrames(packets, count, bp2->payload);
     } else {
-        return websocket_->Send(packet.payload.data(), packet.payload.size(), true);
+        send_buffer_.resize(sizeof(BinaryProtocol3) + frames_size);
+        auto bp3 = (BinaryProtocol3*)send_buffer_.data();
+        bp3->type = kBinaryTypeOpusFrames;
+        bp3->reserved = 0;
+        bp3->payload_size = htons(frames_size);
+        WriteAudioFrames(packets, count, bp3->payload);
     }
+    audio_bytes_sent_ += frames_size - count * sizeof(uint16_t);
+    audio_bytes_copied_ += frames_size - count * sizeof(uint16_t);
+    return websocket_->Send(send_buffer_.data(), send_buffer_.size(), true);
 }
 
 bool WebsocketProtocol::SendText(const std::string& text) {
@@ -86,6 +127,7 @@ void WebsocketProtocol::CloseAudioChannel() {
 }
 
 bool WebsocketProtocol::OpenAudioChannel() {
+    LatencyTracer::GetInstance().Mark(kLatencyChannelOpenStart);
     if (websocket_ != nullptr) {
         delete websocket_;
     }
@@ -99,6 +141,7 @@ bool WebsocketProtocol::OpenAudioChannel() {
     }
 
     error_occurred_ = false;
+    incoming_sequence_ = 0;
 
     websocket_ = Board::GetInstance().CreateWebSocket();
     
@@ -116,38 +159,31 @@ bool WebsocketProtocol::OpenAudioChannel() {
     websocket_->OnData([this](const char* data, size_t len, bool binary) {
         if (binary) {
             if (on_incoming_audio_ != nullptr) {
+                const uint8_t* payload = (const uint8_t*)data;
+                size_t payload_size = len;
+                AudioStreamPacket packet;
+                packet.sample_rate = server_sample_rate_;
+                packet.frame_duration = server_frame_duration_;
+                packet.sequence = ++incoming_sequence_;
                 if (version_ == 2) {
                     BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
                     bp2->version = ntohs(bp2->version);
                     bp2->type = ntohs(bp2->type);
                     bp2->timestamp = ntohl(bp2->timestamp);
                     bp2->payload_size = ntohl(bp2->payload_size);
-                    auto payload = (uint8_t*)bp2->payload;
-                    on_incoming_audio_(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = bp2->timestamp,
-                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
-                    });
+                    packet.timestamp = bp2->timestamp;
+                    payload = bp2->payload;
+                    payload_size = bp2->payload_size;
                 } else if (version_ == 3) {
                     BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
                     bp3->type = bp3->type;
                     bp3->payload_size = ntohs(bp3->payload_size);
-                    auto payload = (uint8_t*)bp3->payload;
-                    on_incoming_audio_(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
-                    });
-                } else {
-                    on_incoming_audio_(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len)
-                    });
+                    payload = bp3->payload;
+                    payload_size = bp3->payload_size;
                 }
+                AcquireAudioBuffer(packet, payload_size);
+                memcpy(packet.payload.data(), payload, payload_size);
+                DeliverIncomingAudio(packet);
             }
         } else {
             // Parse JSON data
@@ -197,6 +233,7 @@ bool WebsocketProtocol::OpenAudioChannel() {
         return false;
     }
 
+    LatencyTracer::GetInstance().Mark(kLatencyChannelOpenEnd);
     if (on_audio_channel_opened_ != nullptr) {
         on_audio_channel_opened_();
     }
@@ -210,19 +247,15 @@ std::string WebsocketProtocol::GetHelloMessage() {
     cJSON_AddStringToObject(root, "type", "hello");
     cJSON_AddNumberToObject(root, "version", version_);
     cJSON* features = cJSON_CreateObject();
-#if CONFIG_USE_SERVER_AEC
-    cJSON_AddBoolToObject(features, "aec", true);
-#endif
-#if CONFIG_IOT_PROTOCOL_MCP
-    cJSON_AddBoolToObject(features, "mcp", true);
-#endif
+    AddClientFeatures(features);
     cJSON_AddItemToObject(root, "features", features);
     cJSON_AddStringToObject(root, "transport", "websocket");
     cJSON* audio_params = cJSON_CreateObject();
     cJSON_AddStringToObject(audio_params, "format", "opus");
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
     cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
+    cJSON_AddNumberToObject(audio_params, "frame_duration", Application::GetInstance().GetUplinkFrameDuration());
+    cJSON_AddBoolToObject(audio_params, "fec", true);
     cJSON_AddItemToObject(root, "audio_params", audio_params);
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
@@ -232,6 +265,7 @@ std::string WebsocketProtocol::GetHelloMessage() {
 }
 
 void WebsocketProtocol::ParseServerHello(const cJSON* root) {
+    LatencyTracer::GetInstance().Mark(kLatencyServerHello);
     auto transport = cJSON_GetObjectItem(root, "transport");
     if (transport == nullptr || strcmp(transport->valuestring, "websocket") != 0) {
         ESP_LOGE(TAG, "Unsupported transport: %s", transport->valuestring);
@@ -256,5 +290,11 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         }
     }
 
+    ParseServerFeatures(root);
+    // Version 1 sends bare Opus frames, without a header to tell the message types apart
+    if (version_ < 2) {
+        audio_aggregation_ = false;
+    }
+
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
 }
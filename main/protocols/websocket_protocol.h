@@ -16,7 +16,8 @@ public:
     ~WebsocketProtocol();
 
     bool Start() override;
-    bool SendAudio(const AudioStreamPacket& packet) override;
+    bool SendAudio(AudioStreamPacket& packet) override;
+    bool SendAudioFrames(AudioStreamPacket* packets, size_t count) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
@@ -25,10 +26,15 @@ private:
     EventGroupHandle_t event_group_handle_;
     WebSocket* websocket_ = nullptr;
     int version_ = 1;
+    uint32_t incoming_sequence_ = 0;
+    // Audio packets without headroom and aggregated frames are serialized here, it keeps its capacity
+    std::vector<uint8_t> send_buffer_;
 
     void ParseServerHello(const cJSON* root);
     bool SendText(const std::string& text) override;
     std::string GetHelloMessage();
+    // Returns where the header of header_size bytes goes, with the Opus data right behind it
+    uint8_t* PrepareAudioMessage(AudioStreamPacket& packet, size_t header_size);
 };
 
 #endif
@@ -0,0 +1,130 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/*
+ * Fixed-capacity single-producer / single-consumer ring buffer.
+ *
+ * Push() must only be called from one producer task at a time and Pop() / Trim()
+ * from one consumer task. Size(), Empty() and Clear() may be called from any task.
+ *
+ * Slots are never destroyed: Push() copy-assigns into the slot and Pop() swaps the
+ * slot with the caller's item, so element types that own buffers (std::vector,
+ * AudioStreamPacket) keep their capacity and the queue does no heap allocation
+ * once every slot has been used once.
+ */
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        slots_.resize(size);
+        mask_ = size - 1;
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Producer side. Returns false and counts an overflow if the queue is full.
+    bool Push(const T& item) {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) > mask_) {
+            overflows_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        slots_[tail & mask_] = item;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Producer side. The item is exchanged with the slot, so it comes back holding
+    // whatever buffers the slot owned before.
+    bool Push(T&& item) {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) > mask_) {
+            overflows_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        std::swap(slots_[tail & mask_], item);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side
+    bool Pop(T& item) {
+        ApplyClear();
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        std::swap(item, slots_[head & mask_]);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Drops the oldest items until at most max_size are left and
+    // returns the number of dropped items.
+    size_t Trim(size_t max_size) {
+        ApplyClear();
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        uint32_t size = tail_.load(std::memory_order_acquire) - head;
+        if (size <= max_size) {
+            return 0;
+        }
+        size_t dropped = size - max_size;
+        head_.store(head + dropped, std::memory_order_release);
+        return dropped;
+    }
+
+    // Any task. The consumer discards everything pushed before this call the next
+    // time it touches the queue.
+    void Clear() {
+        clear_to_.store(tail_.load(std::memory_order_acquire), std::memory_order_release);
+        clear_pending_.store(true, std::memory_order_release);
+    }
+
+    size_t Size() const {
+        uint32_t head = head_.load(std::memory_order_acquire);
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        if (clear_pending_.load(std::memory_order_acquire)) {
+            uint32_t clear_to = clear_to_.load(std::memory_order_acquire);
+            if ((int32_t)(clear_to - head) > 0) {
+                head = clear_to;
+            }
+        }
+        return tail - head;
+    }
+
+    bool Empty() const { return Size() == 0; }
+    size_t capacity() const { return mask_ + 1; }
+    uint32_t overflows() const { return overflows_.load(std::memory_order_relaxed); }
+
+private:
+    std::vector<T> slots_;
+    uint32_t mask_ = 0;
+    std::atomic<uint32_t> head_{0};
+    std::atomic<uint32_t> tail_{0};
+    std::atomic<uint32_t> clear_to_{0};
+    std::atomic<bool> clear_pending_{false};
+    std::atomic<uint32_t> overflows_{0};
+
+    void ApplyClear() {
+        if (!clear_pending_.exchange(false, std::memory_order_acq_rel)) {
+            return;
+        }
+        uint32_t clear_to = clear_to_.load(std::memory_order_acquire);
+        if ((int32_t)(clear_to - head_.load(std::memory_order_relaxed)) > 0) {
+            head_.store(clear_to, std::memory_order_release);
+        }
+    }
+};
+
+#endif // SPSC_QUEUE_H
@@ -141,5 +141,9 @@ void SystemInfo::PrintTaskList() {
 void SystemInfo::PrintHeapStats() {
     int free_sram = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
     int min_free_sram = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
-    ESP_LOGI(TAG, "free sram: %u minimal sram: %u", free_sram, min_free_sram);
+    int largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+    // The share of free memory that is not usable in one allocation
+    int fragmentation = free_sram > 0 ? 100 - largest_block * 100 / free_sram : 0;
+    ESP_LOGI(TAG, "free sram: %u minimal sram: %u largest block: %u fragmentation: %d%%",
+        free_sram, min_free_sram, largest_block, fragmentation);
 }